@@ -3,16 +3,33 @@
 
 #include <libsigrok4DSL/libsigrok.h>
 #include <algorithm> //min/max
+#include <atomic>
 #include <iostream>
 #include <Pothos/Framework.hpp>
 #include <Poco/Logger.h>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
 #include <random>
-#include "devicemanager.h"
+#include <vector>
+#include "devicepool.h"
+#include "devinst.h"
+#include "framesizer.h"
+#include "averager.h"
+#include "persistence.h"
+#include "masktest.h"
+#include "measurement.h"
+#include "autoset.h"
+#include "spectrum.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "logbridge.h"
 #include "sigsession.h"
 #include "blockingqueue.hpp"
 
 using namespace std;
+using json = nlohmann::json;
 //char DS_RES_PATH[256];//="/usr/local/share/DSView/res/";
 
 /***********************************************************************
@@ -21,9 +38,98 @@ using namespace std;
  * The dscope source capture the waveform to an output sample stream.
  *
  * The dscope source will post a sample rate stream label named "rxRate"
- * on the first call to work() after activate() has been called.
- * Downstream blocks like the plotter widgets can consume this label
- * and use it to set internal parameters like the axis scaling.
+ * and a voltage div label named "vdiv" on the first call to work() after
+ * activate() has been called, and again on the first sample of the first
+ * frame captured after the sample rate, vdiv or frame size was changed.
+ * Downstream blocks like the plotter widgets can consume these labels
+ * and use them to set internal parameters like the axis scaling.
+ *
+ * Settings changed while capturing are applied by the sampling thread
+ * between two frames, so no frame mixes two configurations.
+ *
+ * When samples are missing before a frame, because the device overflowed,
+ * a packet was dropped or the capture was re-armed, the dscope source
+ * posts a "discontinuity" label on the first sample of that frame. Its
+ * data is the number of samples lost, 0 when that is not known. The
+ * count is of samples the device delivered, not of sample clock ticks,
+ * the dead time while a triggered capture re-arms is no gap. The
+ * getDiscontinuities() probe counts them.
+ *
+ * Every frame starts with an "rxTime" label holding the wall clock time
+ * it arrived at, in ns since the epoch, except in roll mode.
+ *
+ * The runtime counters are read with the get* probes, or all at once as
+ * a JSON document with getStatus().
+ *
+ * With tracing on, the sampling thread, the queue and work() record
+ * begin/end events. dumpTrace() returns them as Chrome Trace Event JSON,
+ * saveTrace(path) writes them to a file for chrome://tracing or Perfetto.
+ *
+ * Unplugging the device does not stop the graph, work() just produces
+ * nothing until the device is plugged in again. The capture then resumes
+ * with the settings it had, behind a "discontinuity" label.
+ *
+ * A watchdog restarts a capture that delivers no data for a few frame
+ * periods, unless it is armed and waiting for its trigger for less than
+ * watchdogArmed. It restarts the capture first, then the session and
+ * last re-opens the device, the re-opens back off and stop after a few.
+ * getWatchdogRecoveries() counts the steps.
+ *
+ * In averaging mode the dscope source sums averageCount trigger aligned
+ * frames in an integer accumulator and outputs one averaged frame per
+ * averageCount, the noise drops without any work downstream. Raw output
+ * carries the average rounded back to bytes.
+ *
+ * With persistence on, every frame the device delivers is also binned
+ * into a waveform density map by a set of worker threads. The frames are
+ * tapped on the sampling thread, before the queue, so a slow consumer of
+ * output 0 does not thin them out. A snapshot of the map is posted on the
+ * "persistence" port persistenceRate times a second, as a packet with
+ * the uint32 hit counts of columns x 256 cells. Row r counts the raw
+ * sample value r, the metadata holds "columns", "rows", "frames",
+ * "rxRate" and "vdiv".
+ *
+ * In mask test mode every fetched frame is checked against the upper
+ * and lower mask and only the failing frames are output, passing frames
+ * are dropped without a "discontinuity" label. A failing frame starts
+ * with a "maskFail" label holding the number of samples outside the
+ * mask, and every run of such samples is marked with a "maskViolation"
+ * label as wide as the run (the first 16 runs of a frame). Averaging is
+ * off in mask test mode. getMaskTested() and getMaskFailed() count the
+ * frames. The test runs on the frames work() fetches, frames the queue
+ * or the frame pool dropped before are not tested, getMaskUntested()
+ * counts them.
+ *
+ * With measurements on, every captured frame is measured on its raw
+ * samples and the result is posted on the "measure" port as a dictionary
+ * of vmax, vmin, vtop, vbase, amplitude, vmean, vrms (mv), overshoot,
+ * preshoot, duty (%), frequency (Hz), period, riseTime, fallTime (s),
+ * risingEdges and fallingEdges, with the seq and timestamp of the frame.
+ * Values that the frame holds too few edges for are NaN.
+ * getMeasurements() returns the latest as JSON.
+ *
+ * With the spectrum on, the frames work() fetches are transformed on
+ * their raw samples, windowed while they are loaded, and the power
+ * spectrum is averaged or max held over them. Latest mode only transforms
+ * the last fetched frame once per snapshot. A snapshot is posted on the
+ * "spectrum" port spectrumRate times a second, as a packet with the
+ * float32 bins in dBV, bin b covers b to b + 1 times rxRate / 2 / bins.
+ * The metadata holds "bins", "fftSize", "frames", "rxRate" and "vdiv".
+ * The transform uses the largest power of two samples of the frame, up
+ * to 1M. A reconfiguration starts the spectrum over.
+ *
+ * autoset() captures a few probe frames and picks the vdiv and sample
+ * rate, of those the device lists, that show the signal on about 6
+ * divisions with 4 periods per frame, and the trigger level at 50% of
+ * the signal. Rates too slow for two probe frames before the timeout
+ * are not tried. The result is applied in one reconfiguration and
+ * returned as JSON. The block must be active, the probe frames are not
+ * output.
+ *
+ * In roll mode the device streams continuously and every USB packet is
+ * output as soon as it arrives, without the dead time between frames.
+ * The labels are only posted on activation and after a reconfiguration,
+ * never on packet boundaries.
  *
  * |category /DreamSourceLab
  * |category /Sources
@@ -56,7 +162,215 @@ using namespace std;
  * |units mv
  * |widget ComboBox(editable=true)
  *
- * |param logLvl[Debug Log Level]
+ * |param frameSize[Frame Size] The number of samples per captured frame.
+ * In the adaptive modes this is only the starting size.
+ * |default 2048
+ * |units samples
+ * |widget SpinBox(minimum=1024)
+ *
+ * |param rollMode[Roll Mode] Stream gap-free samples instead of discrete frames.
+ * Meant for slow signals at low sample rates, where a whole frame takes
+ * long to capture. The frame size becomes the roll buffer length of the
+ * device and is not adapted.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview enable
+ *
+ * |param average[Averaging] Average repetitive frames to lower the noise.
+ * Block outputs the mean of every averageCount frames, exponential a
+ * running average weighting the newest frame with 1/averageCount.
+ * A configuration change starts the average over. Not used in roll mode,
+ * the frame size is not adapted while averaging.
+ * |option [Off] "off"
+ * |option [Block] "block"
+ * |option [Exponential] "exponential"
+ * |default "off"
+ * |preview enable
+ *
+ * |param averageCount[Average Count] The number of frames per averaged frame.
+ * Rounded up to a power of two in exponential mode.
+ * |default 16
+ * |units frames
+ * |widget SpinBox(minimum=1, maximum=65536)
+ * |preview when(enum=average, "block", "exponential")
+ *
+ * |param persistence[Persistence] Post waveform density map snapshots.
+ * Each frame is copied once more on the sampling thread for the binning
+ * workers, that copy costs about as much as the capture copy itself.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview enable
+ *
+ * |param persistenceColumns[Persistence Columns] The time bins of the density map.
+ * A frame with fewer samples uses one bin per sample.
+ * |default 1024
+ * |widget SpinBox(minimum=1, maximum=16384)
+ * |preview when(enum=persistence, true)
+ *
+ * |param persistenceDecay[Persistence Decay] The fraction of the hits kept per snapshot.
+ * 1.0 keeps all hits (infinite persistence), 0.0 shows only the hits
+ * since the last snapshot.
+ * |default 0.9
+ * |preview when(enum=persistence, true)
+ *
+ * |param persistenceRate[Persistence Rate] Snapshots posted per second.
+ * |default 10.0
+ * |units Hz
+ * |preview when(enum=persistence, true)
+ *
+ * |param persistenceWorkers[Persistence Workers] The threads binning the frames.
+ * |default 2
+ * |widget SpinBox(minimum=1, maximum=16)
+ * |preview when(enum=persistence, true)
+ *
+ * |param maskTest[Mask Test] Output only the frames that violate the mask.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview enable
+ *
+ * |param maskUpper[Upper Mask] The highest allowed voltage, one or more points.
+ * The points are spread evenly over the frame.
+ * |default [1000.0]
+ * |units mv
+ * |preview when(enum=maskTest, true)
+ *
+ * |param maskLower[Lower Mask] The lowest allowed voltage, as many points as the upper mask.
+ * |default [-1000.0]
+ * |units mv
+ * |preview when(enum=maskTest, true)
+ *
+ * |param measure[Measurements] Measure every frame and post the results.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview enable
+ *
+ * |param spectrum[Spectrum] Post power spectrum snapshots.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview enable
+ *
+ * |param spectrumMode[Spectrum Mode] How the spectra of the frames are combined.
+ * |option [Latest] "latest"
+ * |option [Power Average] "average"
+ * |option [Max Hold] "maxhold"
+ * |default "latest"
+ * |preview when(enum=spectrum, true)
+ *
+ * |param spectrumAverage[Spectrum Average] The frames in the power average.
+ * The first frames are averaged evenly, then each new frame is weighed
+ * by 1 / spectrumAverage in an exponential average.
+ * |default 8
+ * |units frames
+ * |widget SpinBox(minimum=1, maximum=65536)
+ * |preview when(enum=spectrumMode, "average")
+ *
+ * |param spectrumWindow[Spectrum Window] The window applied to the samples.
+ * |option [Rectangular] "rectangular"
+ * |option [Hann] "hann"
+ * |option [Hamming] "hamming"
+ * |option [Blackman-Harris] "blackmanharris"
+ * |option [Flat Top] "flattop"
+ * |default "hann"
+ * |preview when(enum=spectrum, true)
+ *
+ * |param spectrumBins[Spectrum Bins] The most bins posted, each the peak of its group.
+ * |default 1024
+ * |widget SpinBox(minimum=1, maximum=65536)
+ * |preview when(enum=spectrum, true)
+ *
+ * |param spectrumRate[Spectrum Rate] Snapshots posted per second.
+ * |default 10.0
+ * |units Hz
+ * |preview when(enum=spectrum, true)
+ *
+ * |param frameMode[Frame Size Mode] How the frame size is chosen.
+ * Latency sizes a frame to take the target latency to capture,
+ * throughput sizes it to fill one output buffer. Both grow the frame
+ * while downstream falls behind. The chosen size can be read with the
+ * getFrameSize() probe.
+ * |option [Fixed] "fixed"
+ * |option [Latency] "latency"
+ * |option [Throughput] "throughput"
+ * |default "fixed"
+ * |preview enable
+ *
+ * |param targetLatency[Target Latency] The capture time of one frame in latency mode.
+ * |default 10.0
+ * |units ms
+ * |preview when(enum=frameMode, "latency")
+ *
+ * |param frameSizeMin[Min Frame Size] The smallest frame size the adaptive modes choose.
+ * The adaptive modes only choose powers of two, the bounds are rounded
+ * inwards to them.
+ * |default 1024
+ * |units samples
+ * |preview when(enum=frameMode, "latency", "throughput")
+ *
+ * |param frameSizeMax[Max Frame Size] The largest frame size the adaptive modes choose.
+ * |default 1048576
+ * |units samples
+ * |preview when(enum=frameMode, "latency", "throughput")
+ *
+ * |param timeout[Wait Timeout] The longest time work() waits for a frame.
+ * work() never blocks the scheduler thread indefinitely, it returns
+ * without output when no frame arrived within this time and is called
+ * again. Waiting threads wake up as soon as a frame arrives.
+ * Zero makes work() only poll the capture queue.
+ * |default 10.0
+ * |units ms
+ * |preview valid
+ *
+ * |param rtPolicy[RT Policy] Scheduling policy of the sampling thread.
+ * The realtime policies keep the USB transfers from being preempted on a
+ * loaded host, they need CAP_SYS_NICE or an rtprio limit.
+ * |option [Normal] "SCHED_OTHER"
+ * |option [FIFO] "SCHED_FIFO"
+ * |option [Round Robin] "SCHED_RR"
+ * |default "SCHED_OTHER"
+ * |preview valid
+ *
+ * |param rtPriority[RT Priority] Priority of the sampling thread, 1 to 99 for the realtime policies.
+ * |default 0
+ * |preview when(enum=rtPolicy, "SCHED_FIFO", "SCHED_RR")
+ *
+ * |param cpuSet[CPU Set] The CPUs the sampling thread may run on, empty for any.
+ * |default []
+ * |preview valid
+ *
+ * |param lockMemory[Lock Memory] Lock the process memory with mlockall.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview valid
+ *
+ * |param watchdog[Watchdog] Recover a capture that stopped delivering data.
+ * |option [Off] false
+ * |option [On] true
+ * |default true
+ * |preview valid
+ *
+ * |param watchdogArmed[Watchdog Armed Limit] How long an armed capture may
+ * wait for its trigger before the watchdog recovers it, a hung device can
+ * report armed forever. Zero waits 10 stall timeouts.
+ * |default 0
+ * |units ms
+ * |preview when(enum=watchdog, true)
+ *
+ * |param trace[Tracing] Record a timeline of the capture pipeline.
+ * Costs next to nothing while off.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview valid
+ *
+ * |param logLvl[Debug Log Level] The level of libsigrok and the capture session.
+ * Messages are queued and written to the "DSCope" logger by a background
+ * thread, each message site is limited to a few messages per second.
  * |option [SR_LOG_NONE] 0
  * |option [SR_LOG_ERR]  1
  * |option [SR_LOG_WARN] 2
@@ -65,23 +379,121 @@ using namespace std;
  * |option [SR_LOG_SPEW] 5
  * |default 2
  *
- * |param dtype[Data Type] The data type produced by the audio source.
+ * |param dtype[Data Type] The data type produced by the dscope source.
+ * Float32 converts the samples to mv. UInt8 streams the raw ADC bytes,
+ * each frame is passed downstream by reference in the buffer it was
+ * captured into, without conversion and without another copy.
  * |option [Float32] "float32"
+ * |option [UInt8 (raw)] "uint8"
  * |default "float32"
  * |preview disable
  *
  * |factory /dsl/dscope(dtype)
  * |setter setSamplerate(sampRate)
  * |setter setVdiv(vdiv)
+ * |setter setFrameSize(frameSize)
+ * |setter setFrameSizeBounds(frameSizeMin, frameSizeMax)
+ * |setter setTargetLatency(targetLatency)
+ * |setter setFrameMode(frameMode)
+ * |setter setRollMode(rollMode)
+ * |setter setAverageMode(average)
+ * |setter setAverageCount(averageCount)
+ * |setter setPersistenceColumns(persistenceColumns)
+ * |setter setPersistenceDecay(persistenceDecay)
+ * |setter setPersistenceRate(persistenceRate)
+ * |setter setPersistenceWorkers(persistenceWorkers)
+ * |setter setPersistence(persistence)
+ * |setter setMask(maskUpper, maskLower)
+ * |setter setMaskTest(maskTest)
+ * |setter setMeasure(measure)
+ * |setter setSpectrumMode(spectrumMode)
+ * |setter setSpectrumAverage(spectrumAverage)
+ * |setter setSpectrumWindow(spectrumWindow)
+ * |setter setSpectrumBins(spectrumBins)
+ * |setter setSpectrumRate(spectrumRate)
+ * |setter setSpectrum(spectrum)
+ * |setter setTimeout(timeout)
+ * |setter setRealtime(rtPolicy, rtPriority)
+ * |setter setCpuSet(cpuSet)
+ * |setter setLockMemory(lockMemory)
+ * |setter setWatchdog(watchdog)
+ * |setter setWatchdogArmed(watchdogArmed)
+ * |setter setTracing(trace)
  * |setter setLogLevel(logLvl)
  **********************************************************************/
 class DscopeSource : public Pothos::Block {
 protected:
+    static const size_t MaxDrainFrames = 64;
+
+    bool _raw = false;
+    bool _roll = false;
+    bool _active = false;
     bool _sendLabel = true;
-    struct sr_context *sr_ctx = NULL;
-    DeviceManager *_device_manager = NULL;
+    bool _waitFirstFrame = false;
+    double _activateLatency = 0.0;
+
+    // where the next frame continues the stream
+    bool _haveSeq = false;
+    uint64_t _nextSeq = 0;
+    uint64_t _nextPos = 0;
+    // a gap before frames the mask test dropped, labeled on the next frame
+    bool _gapPending = false;
+    uint64_t _gapLost = 0;
+
+    Metrics _metrics;
+    std::chrono::nanoseconds _timeout = std::chrono::milliseconds(10);
+
+    // frames drained from the queue by one call, _frameIdx/_frameOffset
+    // is the next sample to convert
+    std::vector<DsoFrame> _frames;
+    size_t _frameIdx = 0;
+    size_t _frameOffset = 0;
+
+    // the average being accumulated, _avgFrame is the last frame added
+    Averager _averager;
+    DsoFrame _avgFrame;
+    size_t _avgOffset = 0;
+    bool _avgReconfigured = false;
+    bool _avgGap = false;
+    uint64_t _avgLost = 0;
+
+    PersistenceMap _persist;
+    bool _persistOn = false;
+    unsigned int _persistWorkers = 2;
+    std::chrono::nanoseconds _persistPeriod = std::chrono::milliseconds(100);
+    std::chrono::steady_clock::time_point _persistNext;
+    uint64_t _persistFrames = 0;
+    std::atomic<uint64_t> _persistRate{0};
+    std::atomic<uint64_t> _persistVdiv{0};
+
+    // the test results of the failing frames in _frames
+    MaskTest _mask;
+    bool _maskOn = false;
+    std::vector<MaskTest::result> _maskResults;
+    // frames lost before the test, from the gaps in the sequence
+    uint64_t _maskUntested = 0;
+    bool _maskHaveSeq = false;
+    uint64_t _maskNextSeq = 0;
+
+    bool _measureOn = false;
+    bool _haveMeasure = false;
+    Measurement::result _lastMeasure;
+
+    Spectrum _spectrum;
+    bool _spectrumOn = false;
+    std::chrono::nanoseconds _spectrumPeriod = std::chrono::milliseconds(100);
+    std::chrono::steady_clock::time_point _spectrumNext;
+    uint64_t _spectrumRate = 0;
+    uint64_t _spectrumVdiv = 0;
+
+    static const int AutosetTimeoutMs = 2000;
+
+    FrameSizer _sizer;
+    uint64_t _frameSize = 2048;
+    std::chrono::high_resolution_clock::time_point _activateTime;
+    boost::shared_ptr<DevicePool::Lease> _lease;
     SigSession *_session = NULL;
-    BlockingQueue<sr_datafeed_dso> *dso_queue = NULL;
+    BlockingQueue<DsoFrame> *dso_queue = NULL;
     const char* lvlStr[6] = {"NONE","ERROR","WARN","INFO","DEBUG","SPEW"};
 public:
     DscopeSource(const Pothos::DType &dtype)
@@ -90,56 +502,127 @@ public:
         //this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setupDevice));
         this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setSamplerate));
         this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setVdiv));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setFrameSize));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setFrameMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setRollMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setAverageMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getAverageMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setAverageCount));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getAverageCount));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setPersistence));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setPersistenceColumns));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setPersistenceDecay));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setPersistenceRate));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setPersistenceWorkers));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, clearPersistence));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setMeasure));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getMeasurements));
+        this->registerProbe("getMeasurements");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setSpectrum));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setSpectrumMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setSpectrumAverage));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setSpectrumWindow));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setSpectrumBins));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setSpectrumRate));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, resetSpectrum));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, autoset));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setMaskTest));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setMask));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, resetMaskCounters));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getMaskTested));
+        this->registerProbe("getMaskTested");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getMaskFailed));
+        this->registerProbe("getMaskFailed");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getMaskUntested));
+        this->registerProbe("getMaskUntested");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getRollMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setTargetLatency));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setFrameSizeBounds));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getFrameSize));
+        this->registerProbe("getFrameSize");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setTimeout));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setRealtime));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setCpuSet));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setLockMemory));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setWatchdog));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setWatchdogArmed));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setTracing));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, clearTrace));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, dumpTrace));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, saveTrace));
         this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, setLogLevel));
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getActivateLatency));
+        this->registerProbe("getActivateLatency");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getDiscontinuities));
+        this->registerProbe("getDiscontinuities");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getFramesReceived));
+        this->registerProbe("getFramesReceived");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getBytesReceived));
+        this->registerProbe("getBytesReceived");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getFramesProduced));
+        this->registerProbe("getFramesProduced");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getDroppedFrames));
+        this->registerProbe("getDroppedFrames");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getOverflows));
+        this->registerProbe("getOverflows");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getQueueDepth));
+        this->registerProbe("getQueueDepth");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getQueueHighWater));
+        this->registerProbe("getQueueHighWater");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getConvertNsPerSample));
+        this->registerProbe("getConvertNsPerSample");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getUsbErrors));
+        this->registerProbe("getUsbErrors");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getWatchdogRecoveries));
+        this->registerProbe("getWatchdogRecoveries");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getErrorState));
+        this->registerProbe("getErrorState");
+        this->registerCall(this, POTHOS_FCN_TUPLE(DscopeSource, getStatus));
+        this->registerProbe("getStatus");
 
         this->setupOutput(0, dtype);
         //this->setupOutput(1, dtype);
+        this->setupOutput("persistence");
+        this->setupOutput("measure");
+        this->setupOutput("spectrum");
+        _raw = (dtype.name() == "uint8");
 
-        // Initialise libsigrok
-        if (sr_init(&sr_ctx) != SR_OK) {
-            throw Pothos::Exception(__func__, "ERROR: libsigrok init failed for the first time!");
-        }
-        // * |initializer setupDevice(dtype)
-        dso_queue = new BlockingQueue<sr_datafeed_dso>();
-        _device_manager = new DeviceManager(sr_ctx);
-        _session = new SigSession(*_device_manager, *dso_queue);
-
-        _session->set_default_device();
+        _frames.reserve(MaxDrainFrames);
+        _maskResults.resize(MaxDrainFrames);
 
-        if( _session->get_device()->name() != "DSCope") {
-            cout << "ERROR: device DSCope not found!" << endl;
-            destruct();
-            throw Pothos::Exception(__func__, "ERROR: device DSCope not found!");
+        // the libsigrok context and the opened device are shared by all
+        // block instances, re-creating the block re-uses the warm device
+        try {
+            _lease = DevicePool::lease("DSCope");
+        } catch (const std::exception &ex) {
+            throw Pothos::Exception(__func__, ex.what());
         }
+        _session = &_lease->session();
+        dso_queue = &_lease->queue();
 
-        ds_trigger_init();
+        // the capture threads only queue their messages, the logger
+        // runs on the log bridge thread
+        LogBridge::set_sink(&DscopeSource::logToPoco);
 
         //_session->register_hotplug_callback();
         //_session->start_hotplug_proc();
-
-        _session->get_device()->set_ch_enable(1, false);
-        _session->get_device()->set_limit_samples(2048);
     }
 
     ~DscopeSource() {
-        destruct();
+        if (_session)
+            stopPersistence();
+        _lease.reset();
     }
 
-    // IMPORTANT! the session must destruct last! or the eavluator thread will lock-up!
-    void destruct() {
-        if(dso_queue != NULL) {
-            cout << "destructing dso_queue." << endl;
-            delete dso_queue;
-        }
-
-        if(_device_manager != NULL) {
-            cout << "destructing device manager." << endl;
-            delete _device_manager;
-        }
-
-        if(_session != NULL) {
-            cout << "destructing session." << endl;
-            delete _session;
+    static void logToPoco(int level, const char *source, const char *text) {
+        Poco::Logger &logger = Poco::Logger::get("DSCope");
+        const std::string msg = std::string(source) + ": " + text;
+        switch (level) {
+        case SR_LOG_ERR: logger.error(msg); break;
+        case SR_LOG_WARN: logger.warning(msg); break;
+        case SR_LOG_INFO: logger.information(msg); break;
+        case SR_LOG_DBG: logger.debug(msg); break;
+        default: logger.trace(msg); break;
         }
     }
 
@@ -148,55 +631,1058 @@ public:
     }
 
     void setVdiv(uint64_t vdiv) {
-        _session->get_device()->set_voltage_div(0, vdiv);
+        _session->queue_config(SR_CONF_PROBE_VDIV, 0, vdiv);
     }
 
     void setSamplerate(uint64_t samplerate) {
-        _session->get_device()->set_sample_rate(samplerate);
+        _session->queue_config(SR_CONF_SAMPLERATE, 0, samplerate);
+    }
+
+    void setFrameSize(uint64_t frameSize) {
+        _frameSize = frameSize;
+        _session->queue_config(SR_CONF_LIMIT_SAMPLES, 0, frameSize);
+    }
+
+    void setFrameMode(const std::string &mode) {
+        if (mode == "fixed") _sizer.set_mode(FrameSizer::Fixed);
+        else if (mode == "latency") _sizer.set_mode(FrameSizer::Latency);
+        else if (mode == "throughput") _sizer.set_mode(FrameSizer::Throughput);
+        else throw Pothos::InvalidArgumentException(__func__, "unknown frame size mode " + mode);
+    }
+
+    void setRollMode(bool roll) {
+        if (roll == _roll)
+            return;
+        _roll = roll;
+        if (_persist.running())
+            tapPersistence();
+        // switching restarts the capture in the other mode
+        if (_active) {
+            _sendLabel = true;
+            _session->resume_capture(_roll);
+        }
+    }
+
+    bool getRollMode(void) const {
+        return _roll;
+    }
+
+    void setAverageMode(const std::string &mode) {
+        Averager::mode m;
+        if (mode == "off") m = Averager::Off;
+        else if (mode == "block") m = Averager::Block;
+        else if (mode == "exponential") m = Averager::Exponential;
+        else throw Pothos::InvalidArgumentException(__func__, "unknown averaging mode " + mode);
+        _averager.set_mode(m);
+        resetAverage();
+    }
+
+    std::string getAverageMode(void) const {
+        switch (_averager.get_mode()) {
+        case Averager::Block: return "block";
+        case Averager::Exponential: return "exponential";
+        default: return "off";
+        }
+    }
+
+    void setAverageCount(unsigned int count) {
+        if (count == 0 || count > Averager::MaxCount)
+            throw Pothos::InvalidArgumentException(__func__, "average count out of range");
+        _averager.set_count(count);
+        resetAverage();
+    }
+
+    unsigned int getAverageCount(void) const {
+        return _averager.get_count();
+    }
+
+    void setPersistence(bool on) {
+        _persistOn = on;
+        if (_active && on != _persist.running()) {
+            if (on) startPersistence();
+            else stopPersistence();
+        }
+    }
+
+    void setPersistenceColumns(unsigned int columns) {
+        if (columns == 0 || columns > PersistenceMap::MaxColumns)
+            throw Pothos::InvalidArgumentException(__func__, "persistence columns out of range");
+        _persist.set_columns(columns);
+    }
+
+    void setPersistenceDecay(double decay) {
+        if (decay < 0.0 || decay > 1.0)
+            throw Pothos::InvalidArgumentException(__func__, "persistence decay must be within [0, 1]");
+        _persist.set_decay(decay);
+    }
+
+    void setPersistenceRate(double rateHz) {
+        if (rateHz <= 0)
+            throw Pothos::InvalidArgumentException(__func__, "persistence rate must be positive");
+        _persistPeriod = std::chrono::nanoseconds((long long)(1e9 / rateHz));
+    }
+
+    void setPersistenceWorkers(unsigned int workers) {
+        if (workers == 0 || workers > PersistenceMap::MaxWorkers)
+            throw Pothos::InvalidArgumentException(__func__, "persistence workers out of range");
+        _persistWorkers = workers;
+        if (_persist.running())
+            startPersistence();
+    }
+
+    void clearPersistence(void) {
+        _persist.clear();
+    }
+
+    void setMeasure(bool on) {
+        _measureOn = on;
+    }
+
+    // the latest measurement, null before the first frame was measured
+    std::string getMeasurements(void) const {
+        if (!_haveMeasure)
+            return json().dump();
+        const Measurement::result &r = _lastMeasure;
+        json m;
+        m["vmax"] = r.vmax;
+        m["vmin"] = r.vmin;
+        m["vtop"] = r.vtop;
+        m["vbase"] = r.vbase;
+        m["amplitude"] = r.amplitude;
+        m["vmean"] = r.vmean;
+        m["vrms"] = r.vrms;
+        m["overshoot"] = r.overshoot;
+        m["preshoot"] = r.preshoot;
+        m["frequency"] = r.frequency;
+        m["period"] = r.period;
+        m["duty"] = r.duty;
+        m["riseTime"] = r.rise_time;
+        m["fallTime"] = r.fall_time;
+        m["risingEdges"] = r.rising_edges;
+        m["fallingEdges"] = r.falling_edges;
+        return m.dump();
+    }
+
+    void setSpectrum(bool on) {
+        _spectrumOn = on;
+        _spectrum.reset();
+        _spectrumNext = std::chrono::steady_clock::now() + _spectrumPeriod;
+    }
+
+    void setSpectrumMode(const std::string &mode) {
+        Spectrum::mode m;
+        if (mode == "latest") m = Spectrum::Latest;
+        else if (mode == "average") m = Spectrum::Average;
+        else if (mode == "maxhold") m = Spectrum::MaxHold;
+        else throw Pothos::InvalidArgumentException(__func__, "unknown spectrum mode " + mode);
+        _spectrum.set_mode(m);
+    }
+
+    void setSpectrumAverage(unsigned int count) {
+        if (count == 0 || count > Spectrum::MaxCount)
+            throw Pothos::InvalidArgumentException(__func__, "spectrum average out of range");
+        _spectrum.set_count(count);
+    }
+
+    void setSpectrumWindow(const std::string &window) {
+        Spectrum::window w;
+        if (window == "rectangular") w = Spectrum::Rectangular;
+        else if (window == "hann") w = Spectrum::Hann;
+        else if (window == "hamming") w = Spectrum::Hamming;
+        else if (window == "blackmanharris") w = Spectrum::BlackmanHarris;
+        else if (window == "flattop") w = Spectrum::FlatTop;
+        else throw Pothos::InvalidArgumentException(__func__, "unknown spectrum window " + window);
+        _spectrum.set_window(w);
+    }
+
+    void setSpectrumBins(unsigned int bins) {
+        if (bins == 0 || bins > Spectrum::MaxBins)
+            throw Pothos::InvalidArgumentException(__func__, "spectrum bins out of range");
+        _spectrum.set_bins(bins);
+    }
+
+    void setSpectrumRate(double rateHz) {
+        if (rateHz <= 0)
+            throw Pothos::InvalidArgumentException(__func__, "spectrum rate must be positive");
+        _spectrumPeriod = std::chrono::nanoseconds((long long)(1e9 / rateHz));
+    }
+
+    void resetSpectrum(void) {
+        _spectrum.reset();
+    }
+
+    std::string autoset(void) {
+        if (!_active)
+            throw Pothos::Exception(__func__, "autoset needs an active block");
+        if (_roll)
+            throw Pothos::Exception(__func__, "autoset does not work in roll mode");
+
+        // the settings the device offers, the |option lists as a fallback
+        static const std::vector<uint64_t> vdivOptions = {10, 20, 50, 100, 200, 500, 1000, 2000};
+        static const std::vector<uint64_t> rateOptions = {
+            1000000, 2000000, 5000000, 10000000, 20000000, 50000000, 100000000, 200000000
+        };
+        const std::vector<uint64_t> vdivs = deviceOptions(SR_CONF_PROBE_VDIV, "vdivs", vdivOptions);
+        const std::vector<uint64_t> rates = deviceOptions(SR_CONF_SAMPLERATE, "samplerates", rateOptions);
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + std::chrono::milliseconds(AutosetTimeoutMs);
+        const uint64_t origVdiv = _session->cur_vdiv();
+        const uint64_t origRate = _session->cur_samplerate();
+
+        // the frames fetched so far are from before autoset
+        _frames.clear();
+        _frameIdx = 0;
+        _frameOffset = 0;
+        resetAverage();
+
+        Autoset as(vdivs, rates, origRate);
+        DsoFrame frame;
+        while (!as.done()) {
+            if (!probeFrame(as.vdiv(), as.samplerate(), frame, deadline)) {
+                _session->queue_config({
+                    {SR_CONF_PROBE_VDIV, 0, origVdiv},
+                    {SR_CONF_SAMPLERATE, 0, origRate}
+                });
+                throw Pothos::Exception(__func__, "no probe frame from the device");
+            }
+            // two probe frames of a lower rate must fit in the time left
+            const std::chrono::duration<double> left = deadline - std::chrono::steady_clock::now();
+            const double minRate = left.count() > 0 ?
+                    2.0 * _session->cur_samplelimits() / left.count() : HUGE_VAL;
+            as.set_min_samplerate(minRate < 1e18 ? (uint64_t)ceil(minRate) : UINT64_MAX);
+            as.feed((const uint8_t *)frame.dso.data, frame.dso.num_samples);
+        }
+
+        _session->queue_config({
+            {SR_CONF_PROBE_VDIV, 0, as.vdiv()},
+            {SR_CONF_SAMPLERATE, 0, as.samplerate()},
+            {SR_CONF_TRIGGER_VALUE, 0, as.trigger_value()}
+        });
+
+        const std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+        json result;
+        result["vdiv"] = as.vdiv();
+        result["samplerate"] = as.samplerate();
+        result["triggerValue"] = as.trigger_value();
+        result["frequency"] = as.frequency();
+        result["probes"] = as.probes();
+        result["elapsedMs"] = elapsed.count();
+        return result.dump();
+    }
+
+    void setMaskTest(bool on) {
+        if (on && !_maskOn) {
+            // the fetched frames not output yet have no results, test
+            // them, the rest of a partly output frame is not output
+            const size_t done = std::min(_frameIdx + (_frameOffset > 0), _frames.size());
+            _frames.erase(_frames.begin(), _frames.begin() + done);
+            _frameIdx = 0;
+            _frameOffset = 0;
+            _maskHaveSeq = false;
+            _maskOn = true;
+            dropPassingFrames();
+        }
+        _maskOn = on;
+        resetAverage();
+    }
+
+    void setMask(const std::vector<double> &upper, const std::vector<double> &lower) {
+        if (upper.empty() || upper.size() != lower.size())
+            throw Pothos::InvalidArgumentException(__func__, "the masks need the same number of points");
+        for (size_t i = 0; i < upper.size(); i++) {
+            if (upper[i] < lower[i])
+                throw Pothos::InvalidArgumentException(__func__, "upper mask below lower mask");
+        }
+        _mask.set_mask(upper, lower);
+    }
+
+    void resetMaskCounters(void) {
+        _mask.reset_counters();
+        _maskUntested = 0;
+    }
+
+    uint64_t getMaskTested(void) const {
+        return _mask.get_tested();
+    }
+
+    uint64_t getMaskFailed(void) const {
+        return _mask.get_failed();
+    }
+
+    uint64_t getMaskUntested(void) const {
+        return _maskUntested;
+    }
+
+    void setTargetLatency(double latencyMs) {
+        if (latencyMs <= 0)
+            throw Pothos::InvalidArgumentException(__func__, "target latency must be positive");
+        _sizer.set_target_latency(latencyMs / 1e3);
+    }
+
+    void setFrameSizeBounds(uint64_t minSize, uint64_t maxSize) {
+        if (minSize == 0 || minSize > maxSize)
+            throw Pothos::InvalidArgumentException(__func__, "invalid frame size bounds");
+        if (!_sizer.set_bounds(minSize, maxSize))
+            throw Pothos::InvalidArgumentException(__func__, "no power of two within the frame size bounds");
+    }
+
+    // frame size applied to the device
+    uint64_t getFrameSize(void) const {
+        return _session->cur_samplelimits();
+    }
+
+    void setTimeout(double timeoutMs) {
+        if (timeoutMs < 0)
+            throw Pothos::InvalidArgumentException(__func__, "timeout must not be negative");
+        _timeout = std::chrono::nanoseconds(static_cast<long long>(timeoutMs * 1e6));
+    }
+
+    void setRealtime(const std::string &policy, int priority) {
+        int sched;
+        if (policy == "SCHED_OTHER") sched = SCHED_OTHER;
+        else if (policy == "SCHED_FIFO") sched = SCHED_FIFO;
+        else if (policy == "SCHED_RR") sched = SCHED_RR;
+        else throw Pothos::InvalidArgumentException(__func__, "unknown policy " + policy);
+
+        std::string error;
+        if (!_session->set_sampling_sched(sched, priority, error))
+            throw Pothos::Exception(__func__, error);
+    }
+
+    void setCpuSet(const std::vector<int> &cpus) {
+        std::string error;
+        if (!_session->set_sampling_affinity(cpus, error))
+            throw Pothos::Exception(__func__, error);
+    }
+
+    void setLockMemory(bool lock) {
+        std::string error;
+        if (!SigSession::lock_memory(lock, error))
+            throw Pothos::Exception(__func__, error);
+    }
+
+    void setWatchdog(bool on) {
+        _session->set_watchdog_enabled(on);
+    }
+
+    void setWatchdogArmed(int64_t ms) {
+        if (ms < 0)
+            throw Pothos::InvalidArgumentException(__func__, "watchdogArmed must not be negative");
+        _session->set_watchdog_armed_limit(ms);
+    }
+
+    void setTracing(bool on) {
+        Tracer::enable(on);
+    }
+
+    void clearTrace(void) {
+        Tracer::clear();
+    }
+
+    std::string dumpTrace(void) const {
+        return Tracer::dump();
+    }
+
+    void saveTrace(const std::string &path) const {
+        std::ofstream out(path.c_str());
+        out << Tracer::dump();
+        if (!out)
+            throw Pothos::Exception(__func__, "cannot write " + path);
     }
 
     void setLogLevel(int logLvl) {
-        cout<< __func__ << "(" << lvlStr[logLvl] << ")" << endl;
+        if (logLvl < SR_LOG_NONE || logLvl > SR_LOG_SPEW)
+            throw Pothos::InvalidArgumentException(__func__, "log level out of range");
+        LogBridge::set_level(logLvl);
         sr_log_loglevel_set(logLvl);
+        DS_LOG(SR_LOG_INFO, "%s(%s)", __func__, lvlStr[logLvl]);
+    }
+
+    // milliseconds from the last activate() to its first frame
+    double getActivateLatency(void) const {
+        return _activateLatency;
+    }
+
+    // frames that did not continue the previous one since construction
+    uint64_t getDiscontinuities(void) const {
+        return _metrics.get(Metrics::Discontinuities);
+    }
+
+    uint64_t getFramesReceived(void) const {
+        return _metrics.get(Metrics::FramesReceived);
+    }
+
+    uint64_t getBytesReceived(void) const {
+        return _metrics.get(Metrics::BytesReceived);
+    }
+
+    uint64_t getFramesProduced(void) const {
+        return _metrics.get(Metrics::FramesProduced);
+    }
+
+    // frames the device sent that never reached the queue
+    uint64_t getDroppedFrames(void) const {
+        return _session->get_dropped_frames();
+    }
+
+    // overflow packets, the device lost samples within a frame
+    uint64_t getOverflows(void) const {
+        return _session->get_overflows();
+    }
+
+    uint64_t getQueueDepth(void) const {
+        return dso_queue->size();
+    }
+
+    uint64_t getQueueHighWater(void) const {
+        return dso_queue->high_water();
+    }
+
+    double getConvertNsPerSample(void) const {
+        const uint64_t samples = _metrics.get(Metrics::ConvertSamples);
+        return samples ? double(_metrics.get(Metrics::ConvertNs)) / samples : 0.0;
+    }
+
+    uint64_t getUsbErrors(void) const {
+        return _session->get_packet_errors();
+    }
+
+    uint64_t getWatchdogRecoveries(void) const {
+        return _session->get_watchdog_capture_restarts() + _session->get_watchdog_session_restarts() +
+               _session->get_watchdog_reopens();
+    }
+
+    std::string getErrorState(void) const {
+        return SigSession::error_string(_session->get_error());
+    }
+
+    // all of the above in one JSON document
+    std::string getStatus(void) const {
+        json status = _metrics.to_json();
+        status["droppedFrames"] = _session->get_dropped_frames();
+        status["overflows"] = _session->get_overflows();
+        status["usbErrors"] = _session->get_packet_errors();
+        status["queueDepth"] = dso_queue->size();
+        status["queueHighWater"] = dso_queue->high_water();
+        status["convertNsPerSample"] = getConvertNsPerSample();
+        status["frameSize"] = _session->cur_samplelimits();
+        status["rollMode"] = _roll;
+        status["average"] = getAverageMode();
+        status["averageCount"] = _averager.get_count();
+        status["persistence"] = _persist.running();
+        status["persistenceSkipped"] = _persist.get_skipped();
+        status["maskTest"] = _maskOn;
+        status["maskTested"] = _mask.get_tested();
+        status["maskFailed"] = _mask.get_failed();
+        status["maskUntested"] = _maskUntested;
+        status["maskViolations"] = _mask.get_violations();
+        status["active"] = _active;
+        status["errorState"] = getErrorState();
+        status["deviceLost"] = _session->is_device_lost();
+        status["detaches"] = _session->get_detach_count();
+        status["attaches"] = _session->get_attach_count();
+        status["watchdog"] = _session->get_watchdog_enabled();
+        status["watchdogCaptureRestarts"] = _session->get_watchdog_capture_restarts();
+        status["watchdogSessionRestarts"] = _session->get_watchdog_session_restarts();
+        status["watchdogReopens"] = _session->get_watchdog_reopens();
+        status["watchdogArmedTimeouts"] = _session->get_watchdog_armed_timeouts();
+        return status.dump();
     }
 
     void activate(void) {
-        _session->start_capture(false);
+        if (!_lease->claim())
+            throw Pothos::Exception(__func__, "ERROR: device DSCope is used by another block!");
+        _sendLabel = true;
+        _waitFirstFrame = true;
+        _frames.clear();
+        _frameIdx = 0;
+        _frameOffset = 0;
+        resetAverage();
+        // the stream starts over, the frames missed while inactive are no gap
+        _haveSeq = false;
+        _gapPending = false;
+        _gapLost = 0;
+        _maskHaveSeq = false;
+        _activateTime = std::chrono::high_resolution_clock::now();
+        _active = true;
+        // a later activate() must be able to claim the device again
+        try {
+            if (_persistOn)
+                startPersistence();
+            _session->resume_capture(_roll);
+        } catch (...) {
+            _active = false;
+            stopPersistence();
+            _lease->unclaim();
+            throw;
+        }
     }
 
     void deactivate(void) {
-        _session->stop_capture();
+        _active = false;
+        _session->pause_capture();
+        // the workers hand their frame buffers back
+        stopPersistence();
+        _lease->unclaim();
     }
 
     void work(void) {
-        if (this->workInfo().minOutElements == 0) return;
+        if (_persist.running()) postPersistence();
+        if (_spectrumOn) postSpectrum();
+        if (averaging()) return _raw ? this->workRawAveraged() : this->workAveraged();
+        if (_raw) return this->workRaw();
 
-        int  numFrames = _session->get_device()->get_sample_limit();
-        numFrames = std::min<int>(numFrames, this->workInfo().minOutElements);
         auto outPort0 = this->output(0);
-        auto buffer = outPort0->buffer().as<float*>();
         const size_t numElems = outPort0->elements();
-        uint64_t vdiv = _session->get_device()->get_voltage_div(0);
-        sr_datafeed_dso dso = dso_queue->take();
+        if (numElems == 0) return;
 
-        for(uint64_t i=0;i<numElems;i++) {
-            uint8_t b = ((uint8_t *)dso.data)[i];
-            //buffer[i]=(127.5 - b) * 10 * vdiv / 256.0f;
-            buffer[i]=(127.5 - b) * vdiv / 25.6f;
+        if (_frameIdx == _frames.size() && !fetchFrames(numElems, true))
+            return this->yield();
+
+        // convert as many queued frames as fit in the output buffer,
+        // a frame that does not fit is continued by the next call
+        const auto workStart = std::chrono::steady_clock::now();
+        const bool tracing = Tracer::enabled();
+        if (tracing) Tracer::begin("convert");
+        auto buffer = outPort0->buffer().as<float*>();
+        size_t produced = 0;
+        unsigned int framesDone = 0;
+        uint64_t samplesDone = 0;
+        uint64_t samplerate = 0;
+        while (produced < numElems) {
+            if (_frameIdx == _frames.size() && !fetchFrames(numElems - produced, false))
+                break;
+
+            const DsoFrame &frame = _frames[_frameIdx];
+            const size_t frameLen = frame.dso.num_samples;
+            samplerate = frame.samplerate;
+            if (_frameOffset == 0) {
+                checkContinuity(frame, produced);
+                postFrameLabels(frame, produced);
+            }
+
+            const size_t n = std::min(numElems - produced, frameLen - _frameOffset);
+            postMaskLabels(_frameIdx, produced, _frameOffset, n);
+            const float scale = frame.vdiv / 25.6f;
+            const uint8_t *src = (const uint8_t *)frame.dso.data + _frameOffset;
+            for (size_t i = 0; i < n; i++) {
+                //buffer[i]=(127.5 - b) * 10 * vdiv / 256.0f;
+                buffer[produced + i] = (127.5f - src[i]) * scale;
+            }
+
+            produced += n;
+            _frameOffset += n;
+            if (_frameOffset >= frameLen) {
+                // hand the frame buffer back to the sampling thread
+                _frames[_frameIdx].buffer.reset();
+                _frameIdx++;
+                _frameOffset = 0;
+                framesDone++;
+                samplesDone += frameLen;
+            }
         }
+        if (tracing) Tracer::end("convert");
 
-        if (_sendLabel) {
-            _sendLabel = false;
-            const auto rate = _session->get_device()->get_sample_rate();
-            Pothos::Label label("rxRate", rate, 0);
-            for (auto port : this->outputs()) port->postLabel(label);
+        const std::chrono::duration<double, std::nano> workTime =
+                std::chrono::steady_clock::now() - workStart;
+        _metrics.add(Metrics::ConvertNs, (uint64_t)workTime.count());
+        _metrics.add(Metrics::ConvertSamples, produced);
+        _metrics.add(Metrics::FramesProduced, framesDone);
+        _metrics.add(Metrics::ElementsProduced, produced);
+
+        // a roll has no frames to size, the packets come as they are
+        if (!_roll && _sizer.get_mode() != FrameSizer::Fixed && framesDone > 0) {
+            // sized from what arrives, the driver may round the request
+            const uint64_t size = _sizer.update(samplerate, _frameSize, samplesDone / framesDone,
+                                                framesDone, workTime.count(),
+                                                dso_queue->size(), numElems);
+            if (size != _frameSize) {
+                _frameSize = size;
+                _session->queue_config(SR_CONF_LIMIT_SAMPLES, 0, size);
+            }
         }
 
         //not ready to produce because of backoff
         //if (_readyTime >= std::chrono::high_resolution_clock::now()) return this->yield();
 
         //produce buffer (all modes)
-        outPort0->produce(numElems);
+        TRACE_SCOPE("produce");
+        outPort0->produce(produced);
+    }
+
+private:
+    // post whole frames downstream by reference, no conversion and no copy
+    void workRaw(void) {
+        auto outPort0 = this->output(0);
+        if (!fetchFrames(SIZE_MAX, true))
+            return this->yield();
+
+        size_t posted = 0;
+        for (size_t i = 0; i < _frames.size(); i++) {
+            const DsoFrame &frame = _frames[i];
+            checkContinuity(frame, posted);
+            postFrameLabels(frame, posted);
+            postMaskLabels(i, posted, 0, frame.dso.num_samples);
+            Pothos::BufferChunk chunk(Pothos::SharedBuffer(
+                    size_t(frame.buffer.get()), frame.bytes, frame.buffer));
+            chunk.dtype = outPort0->dtype();
+            outPort0->postBuffer(chunk);
+            posted += frame.bytes;
+        }
+        _metrics.add(Metrics::FramesProduced, _frames.size());
+        _metrics.add(Metrics::ElementsProduced, posted);
+        _frames.clear();
+        _frameIdx = 0;
+    }
+
+    void startPersistence(void) {
+        // the workers go away under a running tap otherwise
+        _session->set_frame_tap(nullptr);
+        _persist.start(_persistWorkers);
+        _persistNext = std::chrono::steady_clock::now() + _persistPeriod;
+        _persistFrames = 0;
+        tapPersistence();
+    }
+
+    void stopPersistence(void) {
+        _session->set_frame_tap(nullptr);
+        _persist.stop();
+    }
+
+    // bin the frames on the sampling thread, roll mode packets are not
+    // trigger aligned
+    void tapPersistence(void) {
+        if (_roll) {
+            _session->set_frame_tap(nullptr);
+            return;
+        }
+        _session->set_frame_tap([this](const DsoFrame &frame) {
+            if (frame.reconfigured)
+                _persist.clear();
+            _persistRate = frame.samplerate;
+            _persistVdiv = frame.vdiv;
+            _persist.add(frame);
+        });
+    }
+
+    // post a snapshot of the density map once per period
+    void postPersistence(void) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now < _persistNext)
+            return;
+        _persistNext = std::max(_persistNext + _persistPeriod, now);
+
+        TRACE_SCOPE("persistence_snapshot");
+        _persistFrames += _persist.merge();
+        const std::vector<uint32_t> &grid = _persist.grid();
+        if (grid.empty())
+            return;
+
+        Pothos::Packet packet;
+        packet.payload = Pothos::BufferChunk(Pothos::DType("uint32"), grid.size());
+        std::copy(grid.begin(), grid.end(), packet.payload.as<uint32_t *>());
+        packet.metadata["columns"] = Pothos::Object(_persist.columns());
+        packet.metadata["rows"] = Pothos::Object(PersistenceMap::Rows);
+        packet.metadata["frames"] = Pothos::Object(_persistFrames);
+        packet.metadata["rxRate"] = Pothos::Object(_persistRate.load());
+        packet.metadata["vdiv"] = Pothos::Object(_persistVdiv.load());
+        this->output("persistence")->postMessage(packet);
+    }
+
+    // transform the fetched frames, in latest mode only the last frame
+    // before a snapshot is due, roll mode packets are not frames
+    void feedSpectrum(void) {
+        if (_roll)
+            return;
+        TRACE_SCOPE("spectrum");
+        const bool latest = _spectrum.get_mode() == Spectrum::Latest;
+        if (latest && std::chrono::steady_clock::now() < _spectrumNext)
+            return;
+        for (size_t i = latest ? _frames.size() - 1 : 0; i < _frames.size(); i++) {
+            const DsoFrame &frame = _frames[i];
+            if (frame.reconfigured || frame.samplerate != _spectrumRate)
+                _spectrum.reset();
+            _spectrumRate = frame.samplerate;
+            _spectrumVdiv = frame.vdiv;
+            _spectrum.add((const uint8_t *)frame.dso.data, frame.dso.num_samples, frame.vdiv);
+        }
+    }
+
+    // post a snapshot of the spectrum once per period
+    void postSpectrum(void) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now < _spectrumNext || _spectrum.frames() == 0)
+            return;
+        _spectrumNext = std::max(_spectrumNext + _spectrumPeriod, now);
+
+        Pothos::Packet packet;
+        packet.payload = Pothos::BufferChunk(Pothos::DType("float32"), _spectrum.bins());
+        _spectrum.to_db(packet.payload.as<float *>());
+        packet.metadata["bins"] = Pothos::Object(_spectrum.bins());
+        packet.metadata["fftSize"] = Pothos::Object(_spectrum.size());
+        packet.metadata["frames"] = Pothos::Object(_spectrum.frames());
+        packet.metadata["rxRate"] = Pothos::Object(_spectrumRate);
+        packet.metadata["vdiv"] = Pothos::Object(_spectrumVdiv);
+        this->output("spectrum")->postMessage(packet);
+    }
+
+    // roll mode packets are not trigger aligned, they are not averaged
+    bool averaging(void) const {
+        return _averager.get_mode() != Averager::Off && !_roll && !_maskOn;
+    }
+
+    void resetAverage(void) {
+        _averager.reset();
+        _avgFrame = DsoFrame();
+        _avgOffset = 0;
+        _avgReconfigured = false;
+        _avgGap = false;
+        _avgLost = 0;
+    }
+
+    // add a frame to the average, true when an averaged frame is ready
+    bool accumulate(const DsoFrame &frame) {
+        uint64_t lost = 0;
+        const bool gap = isDiscontinuity(frame, lost);
+        // frames of another configuration are not averaged together, the
+        // labels of the discarded partial average go with it
+        const bool changed = !_averager.empty() &&
+            (frame.vdiv != _avgFrame.vdiv || frame.samplerate != _avgFrame.samplerate);
+        if (frame.reconfigured || changed) {
+            _averager.reset();
+            _avgGap = false;
+            _avgLost = 0;
+            _avgReconfigured = changed;
+        }
+        if (gap) {
+            _avgGap = true;
+            _avgLost += lost;
+        }
+        _avgReconfigured = _avgReconfigured || frame.reconfigured;
+        _avgFrame = frame;
+        return _averager.add((const uint8_t *)frame.dso.data, frame.dso.num_samples);
+    }
+
+    // labels for the averaged frame starting at element index
+    void postAverageLabels(size_t index) {
+        if (_avgGap)
+            postDiscontinuity(_avgLost, index);
+        _avgGap = false;
+        _avgLost = 0;
+        _avgFrame.reconfigured = _avgReconfigured;
+        _avgReconfigured = false;
+        postFrameLabels(_avgFrame, index);
+    }
+
+    // accumulate the queued frames, convert the averaged ones
+    void workAveraged(void) {
+        auto outPort0 = this->output(0);
+        const size_t numElems = outPort0->elements();
+        if (numElems == 0) return;
+
+        const auto workStart = std::chrono::steady_clock::now();
+        auto buffer = outPort0->buffer().as<float*>();
+        size_t produced = 0;
+        unsigned int framesDone = 0;
+        bool waited = false;
+        while (produced < numElems) {
+            if (!_averager.ready()) {
+                if (_frameIdx == _frames.size()) {
+                    if (!fetchFrames(SIZE_MAX, !waited))
+                        break;
+                    waited = true;
+                }
+                // the plain path output part of this frame already
+                if (_frameOffset > 0) {
+                    _frameOffset = 0;
+                    _frameIdx++;
+                    continue;
+                }
+                accumulate(_frames[_frameIdx]);
+                // the accumulator holds the samples, the buffer can go back
+                _frames[_frameIdx].buffer.reset();
+                _avgFrame.buffer.reset();
+                _frameIdx++;
+                continue;
+            }
+
+            if (_avgOffset == 0)
+                postAverageLabels(produced);
+            const size_t n = std::min(numElems - produced, _averager.length() - _avgOffset);
+            _averager.to_float(buffer + produced, _avgOffset, n, _avgFrame.vdiv / 25.6f);
+            produced += n;
+            _avgOffset += n;
+            if (_avgOffset >= _averager.length()) {
+                _averager.consume();
+                _avgOffset = 0;
+                framesDone++;
+            }
+        }
+
+        const std::chrono::duration<double, std::nano> workTime =
+                std::chrono::steady_clock::now() - workStart;
+        _metrics.add(Metrics::ConvertNs, (uint64_t)workTime.count());
+        _metrics.add(Metrics::ConvertSamples, produced);
+        _metrics.add(Metrics::FramesProduced, framesDone);
+        _metrics.add(Metrics::ElementsProduced, produced);
+
+        if (produced == 0)
+            return this->yield();
+        TRACE_SCOPE("produce");
+        outPort0->produce(produced);
+    }
+
+    // the average is rounded into the buffer of its last frame and
+    // posted by reference like the plain raw frames
+    void workRawAveraged(void) {
+        auto outPort0 = this->output(0);
+        if (!fetchFrames(SIZE_MAX, true))
+            return this->yield();
+
+        size_t posted = 0;
+        unsigned int framesDone = 0;
+        for (DsoFrame &frame : _frames) {
+            const bool ready = accumulate(frame);
+            frame.buffer.reset();
+            if (!ready) {
+                _avgFrame.buffer.reset();
+                continue;
+            }
+
+            postAverageLabels(posted);
+            _averager.to_raw(_avgFrame.buffer.get());
+            const size_t len = _averager.length();
+            Pothos::BufferChunk chunk(Pothos::SharedBuffer(
+                    size_t(_avgFrame.buffer.get()), len, _avgFrame.buffer));
+            chunk.dtype = outPort0->dtype();
+            outPort0->postBuffer(chunk);
+            _avgFrame.buffer.reset();
+            _averager.consume();
+            posted += len;
+            framesDone++;
+        }
+        _metrics.add(Metrics::FramesProduced, framesDone);
+        _metrics.add(Metrics::ElementsProduced, posted);
+        _frames.clear();
+        _frameIdx = 0;
+    }
+
+    // refill _frames with up to maxSamples worth of queued frames
+    bool fetchFrames(size_t maxSamples, bool wait) {
+        TRACE_SCOPE("queue_take");
+        _frames.clear();
+        _frameIdx = 0;
+        _frameOffset = 0;
+
+        dso_queue->drain(_frames, _frames.capacity(), maxSamples,
+                         [](const DsoFrame &f) { return (size_t)f.dso.num_samples; });
+
+        if (_frames.empty() && wait) {
+            // wait for the sampling thread, bounded by the scheduler timeout
+            const auto maxTimeout = std::chrono::nanoseconds(this->workInfo().maxTimeoutNs);
+            const auto timeout = std::min(_timeout, maxTimeout);
+            DsoFrame frame;
+            if (timeout.count() > 0 && dso_queue->take_for(frame, timeout))
+                _frames.push_back(frame);
+        }
+
+        if (_frames.empty())
+            return false;
+
+        if (_spectrumOn)
+            feedSpectrum();
+        if (_measureOn)
+            measureFrames();
+        _metrics.add(Metrics::FramesReceived, _frames.size());
+        for (const DsoFrame &frame : _frames)
+            _metrics.add(Metrics::BytesReceived, frame.bytes);
+
+        if (_waitFirstFrame) {
+            _waitFirstFrame = false;
+            std::chrono::duration<double, std::milli> latency =
+                    std::chrono::high_resolution_clock::now() - _activateTime;
+            _activateLatency = latency.count();
+        }
+
+        if (_maskOn)
+            dropPassingFrames();
+        return !_frames.empty();
+    }
+
+    // the ascending values of the list name the driver gives for key
+    std::vector<uint64_t> deviceOptions(int key, const char *name,
+                                        const std::vector<uint64_t> &fallback) {
+        std::vector<uint64_t> values;
+        boost::shared_ptr<DevInst> dev = _session->get_device();
+        GVariant *dict = dev ? dev->list_config(NULL, key) : NULL;
+        if (dict) {
+            GVariant *list = g_variant_lookup_value(dict, name, G_VARIANT_TYPE("at"));
+            if (list) {
+                gsize n = 0;
+                const uint64_t *v = (const uint64_t *)g_variant_get_fixed_array(
+                        list, &n, sizeof(uint64_t));
+                values.assign(v, v + n);
+                g_variant_unref(list);
+            }
+            g_variant_unref(dict);
+        }
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        values.erase(std::remove(values.begin(), values.end(), 0), values.end());
+        return values.empty() ? fallback : values;
+    }
+
+    // a frame captured with vdiv and samplerate, the frame the change was
+    // applied on is skipped, the front end may still be settling
+    bool probeFrame(uint64_t vdiv, uint64_t samplerate, DsoFrame &frame,
+                    std::chrono::steady_clock::time_point deadline) {
+        // the frames queued before are stale, the generation tells the
+        // ones the sampling thread queues until the change is applied
+        dso_queue->clear();
+        const uint64_t gen = _session->queue_config({
+            {SR_CONF_PROBE_VDIV, 0, vdiv},
+            {SR_CONF_SAMPLERATE, 0, samplerate}
+        });
+        bool applied = false;
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (!dso_queue->take_for(frame, std::chrono::milliseconds(10)))
+                continue;
+            if (frame.config_gen < gen)
+                continue;
+            if (applied)
+                return true;
+            applied = true;
+        }
+        return false;
+    }
+
+    // measure the fetched frames before anything is dropped or averaged
+    void measureFrames(void) {
+        TRACE_SCOPE("measure");
+        auto port = this->output("measure");
+        for (const DsoFrame &frame : _frames) {
+            Measurement::result &r = _lastMeasure;
+            if (!Measurement::measure((const uint8_t *)frame.dso.data, frame.dso.num_samples,
+                                      frame.samplerate, frame.vdiv, r))
+                continue;
+            _haveMeasure = true;
+
+            Pothos::ObjectKwargs m;
+            m["vmax"] = Pothos::Object(r.vmax);
+            m["vmin"] = Pothos::Object(r.vmin);
+            m["vtop"] = Pothos::Object(r.vtop);
+            m["vbase"] = Pothos::Object(r.vbase);
+            m["amplitude"] = Pothos::Object(r.amplitude);
+            m["vmean"] = Pothos::Object(r.vmean);
+            m["vrms"] = Pothos::Object(r.vrms);
+            m["overshoot"] = Pothos::Object(r.overshoot);
+            m["preshoot"] = Pothos::Object(r.preshoot);
+            m["frequency"] = Pothos::Object(r.frequency);
+            m["period"] = Pothos::Object(r.period);
+            m["duty"] = Pothos::Object(r.duty);
+            m["riseTime"] = Pothos::Object(r.rise_time);
+            m["fallTime"] = Pothos::Object(r.fall_time);
+            m["risingEdges"] = Pothos::Object(r.rising_edges);
+            m["fallingEdges"] = Pothos::Object(r.falling_edges);
+            m["seq"] = Pothos::Object(frame.seq);
+            m["timestamp"] = Pothos::Object(frame.timestamp_ns);
+            port->postMessage(m);
+        }
+    }
+
+    // keep only the frames that fail the mask test, with their results
+    void dropPassingFrames(void) {
+        TRACE_SCOPE("mask_test");
+        size_t kept = 0;
+        for (size_t i = 0; i < _frames.size(); i++) {
+            DsoFrame &frame = _frames[i];
+            // a re-armed capture counts from zero again
+            if (_maskHaveSeq && frame.seq > _maskNextSeq)
+                _maskUntested += frame.seq - _maskNextSeq;
+            _maskHaveSeq = true;
+            _maskNextSeq = frame.seq + 1;
+
+            MaskTest::result &res = _maskResults[kept];
+            if (!_mask.check((const uint8_t *)frame.dso.data, frame.dso.num_samples, frame.vdiv, res)) {
+                if (kept != i)
+                    _frames[kept] = std::move(frame);
+                kept++;
+                continue;
+            }
+            // a dropped frame is no gap, a gap before it and its
+            // configuration labels go with the next frame that is output
+            uint64_t lost = 0;
+            if (isDiscontinuity(frame, lost)) {
+                _gapPending = true;
+                _gapLost += lost;
+            }
+            if (frame.reconfigured)
+                _sendLabel = true;
+        }
+        _frames.resize(kept);
+    }
+
+    // mask test labels of the samples [offset, offset + n) of _frames[frame],
+    // output starting at element index
+    void postMaskLabels(size_t frame, size_t index, size_t offset, size_t n) {
+        if (!_maskOn)
+            return;
+        const MaskTest::result &res = _maskResults[frame];
+        auto port = this->output(0);
+        if (offset == 0)
+            port->postLabel(Pothos::Label("maskFail", res.violations, index));
+        for (unsigned int r = 0; r < res.runs; r++) {
+            const size_t start = res.run_start[r];
+            if (start >= offset && start < offset + n)
+                port->postLabel(Pothos::Label("maskViolation", start,
+                                              index + start - offset, res.run_length[r]));
+        }
+    }
+
+    // label the frame starting at element index if it does not continue
+    // the stream where the previous frame ended
+    void checkContinuity(const DsoFrame &frame, size_t index) {
+        uint64_t lost = 0;
+        if (isDiscontinuity(frame, lost) || _gapPending)
+            postDiscontinuity(_gapLost + lost, index);
+        _gapPending = false;
+        _gapLost = 0;
+    }
+
+    // advance the stream position past frame, true with the number of
+    // samples lost when it does not continue where the previous one ended
+    bool isDiscontinuity(const DsoFrame &frame, uint64_t &lost) {
+        const bool gap = _haveSeq && (frame.discontinuity || frame.seq != _nextSeq);
+        // a re-armed capture counts from zero again, the loss is unknown
+        if (gap)
+            lost = frame.sample_pos > _nextPos ? frame.sample_pos - _nextPos : 0;
+        _haveSeq = true;
+        _nextSeq = frame.seq + 1;
+        _nextPos = frame.sample_pos + frame.dso.num_samples;
+        return gap;
+    }
+
+    void postDiscontinuity(uint64_t lost, size_t index) {
+        _metrics.add(Metrics::Discontinuities);
+        this->output(0)->postLabel(Pothos::Label("discontinuity", lost, index));
+    }
+
+    // labels for the frame starting at element index of this work() call
+    void postFrameLabels(const DsoFrame &frame, size_t index) {
+        // the persistence and spectrum ports carry their own metadata
+        auto port = this->output(0);
+        if (!_roll)
+            port->postLabel(Pothos::Label("rxTime", frame.timestamp_ns, index));
+        if (!_sendLabel && !frame.reconfigured)
+            return;
+
+        _sendLabel = false;
+        Pothos::Label rateLabel("rxRate", frame.samplerate, index);
+        Pothos::Label vdivLabel("vdiv", frame.vdiv, index);
+        port->postLabel(rateLabel);
+        port->postLabel(vdivLabel);
     }
 };
 
@@ -0,0 +1,80 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <atomic>
+#include <errno.h>
+#include <stddef.h>
+
+#include "allocaudit.h"
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+namespace AllocAudit {
+
+static std::atomic<uint64_t> _count(0);
+static __thread int _depth = 0;
+
+uint64_t count()
+{
+    return _count;
+}
+
+void reset()
+{
+    _count = 0;
+}
+
+Scope::Scope()
+{
+    _depth++;
+}
+
+Scope::~Scope()
+{
+    _depth--;
+}
+
+static inline void account()
+{
+    if (_depth > 0)
+        _count.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
+
+extern "C" {
+
+void *malloc(size_t size)
+{
+    AllocAudit::account();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    AllocAudit::account();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    AllocAudit::account();
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    AllocAudit::account();
+    void *p = __libc_memalign(alignment, size);
+    if (p == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+}
@@ -0,0 +1,36 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _ALLOCAUDIT_H_
+#define _ALLOCAUDIT_H_
+
+#include <stdint.h>
+
+/**
+ * Heap allocation counter for the capture path.
+ *
+ * Built with DSCOPE_ALLOC_AUDIT, malloc/calloc/realloc/posix_memalign
+ * (and operator new, which allocates through malloc) are counted while
+ * the calling thread is inside an ALLOC_AUDIT_SCOPE. Without the define
+ * the scope compiles to nothing. Only link allocaudit.cpp into an
+ * executable, it replaces the allocator entry points.
+ */
+namespace AllocAudit {
+
+uint64_t count();
+void reset();
+
+struct Scope {
+    Scope();
+    ~Scope();
+};
+
+}
+
+#ifdef DSCOPE_ALLOC_AUDIT
+#define ALLOC_AUDIT_SCOPE() AllocAudit::Scope _alloc_audit_scope
+#else
+#define ALLOC_AUDIT_SCOPE() do {} while (0)
+#endif
+
+#endif  // _ALLOCAUDIT_H_
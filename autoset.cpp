@@ -0,0 +1,223 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "autoset.h"
+#include "measurement.h"
+
+const double Autoset::TargetDivs = 6.0;
+const double Autoset::MaxDivs = 9.0;
+const double Autoset::TargetPeriods = 4.0;
+
+// raw samples per division, 256 over 10 divisions
+static const double LevelsPerDiv = 25.6;
+
+// share of the samples ignored at either end of the histogram, and the
+// share at the rails that counts as clipping
+static const double Outliers = 0.001;
+
+Autoset::Autoset(const std::vector<uint64_t> &vdivs, const std::vector<uint64_t> &samplerates,
+                 uint64_t samplerate) :
+        _vdivs(vdivs),
+        _rates(samplerates),
+        _phase(Vdiv),
+        _probes(0),
+        _vlo(0), _vhi(0), _vidx(0),
+        _rlo(0), _rhi(0), _ridx(0),
+        _good_ridx(-1),
+        _rate(samplerate),
+        _orig_rate(samplerate),
+        _min_rate(0),
+        _level(0),
+        _trigger(128),
+        _frequency(NAN)
+{
+    assert(!_vdivs.empty() && !_rates.empty());
+    start_vdiv(Vdiv);
+}
+
+bool Autoset::done() const
+{
+    return _phase == Done;
+}
+
+uint64_t Autoset::vdiv() const
+{
+    return _vdivs[_vidx];
+}
+
+uint64_t Autoset::samplerate() const
+{
+    return _phase == Rate ? _rates[_ridx] : _rate;
+}
+
+uint8_t Autoset::trigger_value() const
+{
+    return _trigger;
+}
+
+double Autoset::frequency() const
+{
+    return _frequency;
+}
+
+unsigned int Autoset::probes() const
+{
+    return _probes;
+}
+
+// the largest vdiv is assumed not to clip, the search starts there unless
+// an earlier phase already found a good one
+void Autoset::start_vdiv(phase next)
+{
+    _vlo = 0;
+    _vhi = _vdivs.size() - 1;
+    if (next == Vdiv)
+        _vidx = _vhi;
+    _phase = next;
+}
+
+void Autoset::set_min_samplerate(uint64_t samplerate)
+{
+    _min_rate = samplerate;
+}
+
+// the lowest rate index at or above the minimum rate
+size_t Autoset::min_ridx() const
+{
+    return std::lower_bound(_rates.begin(), _rates.end(), _min_rate) - _rates.begin();
+}
+
+void Autoset::feed(const uint8_t *data, size_t len)
+{
+    assert(_phase != Done);
+    if (len == 0)
+        return;
+    _probes++;
+
+    // the 50% level of every probe, the last one is at the result
+    Measurement::result m;
+    Measurement::measure(data, len, samplerate(), vdiv(), m);
+    _level = (m.vtop + m.vbase) / 2;
+
+    if (_phase == Rate)
+        feed_rate(m, len);
+    else
+        feed_vdiv(data, len);
+
+    // out of probes, settle for what is known to work
+    if (_probes >= MaxProbes && _phase != Done) {
+        _vidx = _vhi;
+        if (_phase == Rate)
+            _rate = _good_ridx >= 0 ? _rates[_good_ridx] : _orig_rate;
+        _phase = Done;
+    }
+
+    // the raw trigger value at the vdiv the level is set with
+    const double mid = _level * LevelsPerDiv / vdiv() + 127.5;
+    _trigger = (uint8_t)std::min(255.0, std::max(0.0, round(255.0 - mid)));
+}
+
+void Autoset::feed_vdiv(const uint8_t *data, size_t len)
+{
+    uint32_t hist[256];
+    memset(hist, 0, sizeof(hist));
+    for (size_t i = 0; i < len; i++)
+        hist[data[i]]++;
+
+    // peak to peak without the outliers
+    const uint64_t skip = (uint64_t)(Outliers * len);
+    uint64_t acc = 0;
+    int lo = 0, hi = 255;
+    for (int r = 0; r < 256; r++) {
+        acc += hist[r];
+        if (acc > skip) {
+            lo = r;
+            break;
+        }
+    }
+    acc = 0;
+    for (int r = 255; r >= 0; r--) {
+        acc += hist[r];
+        if (acc > skip) {
+            hi = r;
+            break;
+        }
+    }
+    const double divs = (hi - lo) / LevelsPerDiv;
+    const bool clipped = hist[0] + hist[255] > skip || divs > MaxDivs;
+    const phase after = (_phase == Vdiv) ? Rate : Done;
+
+    if (clipped) {
+        // bisect towards the larger vdivs, the largest is used as it is
+        if (_vidx >= _vhi) {
+            _phase = after;
+        } else {
+            _vlo = _vidx + 1;
+            _vidx = (_vlo + _vhi) / 2;
+        }
+    } else {
+        // the option nearest to TargetDivs that stays within MaxDivs
+        _vhi = _vidx;
+        const double mv = divs * _vdivs[_vidx];
+        size_t cand = _vidx;
+        for (size_t i = _vlo; i <= _vhi; i++) {
+            const double d = mv / _vdivs[i];
+            if (d <= MaxDivs && fabs(d - TargetDivs) < fabs(mv / _vdivs[cand] - TargetDivs))
+                cand = i;
+        }
+        if (cand == _vidx)
+            _phase = after;
+        else
+            _vidx = cand;
+    }
+
+    if (_phase == Rate) {
+        _rlo = 0;
+        _rhi = _rates.size() - 1;
+        _ridx = _rhi;
+        _good_ridx = -1;
+    }
+}
+
+void Autoset::feed_rate(const Measurement::result &m, size_t len)
+{
+    if (m.rising_edges < 2) {
+        // too few periods in the frame, bisect towards the lower rates
+        // down to the minimum, without a periodic signal at any of them
+        // the rate is kept as it was
+        _rlo = std::max(_rlo, min_ridx());
+        if (_ridx <= _rlo) {
+            _rate = _orig_rate;
+            _phase = Done;
+            return;
+        }
+        _rhi = _ridx - 1;
+        _ridx = (_rlo + _rhi + 1) / 2;
+        return;
+    }
+
+    // the highest rate that still shows TargetPeriods periods, up to the
+    // rate below the lowest one that failed, the prediction is probed
+    _good_ridx = std::max(_good_ridx, (int)_ridx);
+    _frequency = m.frequency;
+    const double ideal = m.frequency * len / TargetPeriods;
+    size_t cand = std::upper_bound(_rates.begin(), _rates.end(), (uint64_t)ideal) - _rates.begin();
+    cand = cand > 0 ? cand - 1 : 0;
+    cand = std::max(_rlo, std::min(_rhi, cand));
+    // the probed rate fits the time, a lower one may not
+    cand = std::max(cand, std::min(_ridx, min_ridx()));
+    if (cand != _ridx) {
+        _ridx = cand;
+        return;
+    }
+    _rate = _rates[_ridx];
+    if (_rate != _orig_rate)
+        start_vdiv(VdivCheck);
+    else
+        _phase = Done;
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _AUTOSET_H_
+#define _AUTOSET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "measurement.h"
+
+/**
+ * Picks vdiv, sample rate and trigger level from a few probe frames.
+ *
+ * The caller captures one frame with vdiv() and samplerate() and feeds it
+ * until done(). The vdiv is predicted from the peak to peak of the frame,
+ * the option nearest to TargetDivs that does not exceed MaxDivs, a
+ * clipping frame bisects towards the larger vdivs. The sample rate starts
+ * at the highest option (no aliasing) and bisects down until the frame
+ * holds two periods, then the rate is predicted from the measured
+ * frequency, up to the rate below the lowest one that showed too few
+ * periods, and probed. Rates below the minimum the caller sets are not
+ * probed, the search keeps the original rate when it runs into them.
+ * When the rate changed, the vdiv is checked once more at the new rate.
+ * The trigger level is the 50% level of the last frame, at the final
+ * vdiv.
+ */
+class Autoset
+{
+public:
+    static const unsigned int MaxProbes = 24;
+
+    // the signal spans this many of the 10 divisions
+    static const double TargetDivs;
+    static const double MaxDivs;
+
+    // periods shown in one frame
+    static const double TargetPeriods;
+
+public:
+    /**
+     * @param vdivs the vdiv options in mv, ascending
+     * @param samplerates the sample rate options, ascending
+     * @param samplerate current sample rate, kept without a periodic signal
+     */
+    Autoset(const std::vector<uint64_t> &vdivs, const std::vector<uint64_t> &samplerates,
+            uint64_t samplerate);
+
+    bool done() const;
+
+    // the setting of the next probe frame, the result when done
+    uint64_t vdiv() const;
+    uint64_t samplerate() const;
+
+    // account a frame captured with vdiv() and samplerate()
+    void feed(const uint8_t *data, size_t len);
+
+    // the lowest rate worth probing, e.g. two frames in the time left
+    void set_min_samplerate(uint64_t samplerate);
+
+    // raw sample value at the 50% level
+    uint8_t trigger_value() const;
+
+    // NaN without a periodic signal
+    double frequency() const;
+
+    unsigned int probes() const;
+
+private:
+    enum phase {
+        Vdiv,
+        Rate,
+        VdivCheck,
+        Done
+    };
+
+    void feed_vdiv(const uint8_t *data, size_t len);
+    void feed_rate(const Measurement::result &m, size_t len);
+    void start_vdiv(phase next);
+    size_t min_ridx() const;
+
+private:
+    std::vector<uint64_t> _vdivs;
+    std::vector<uint64_t> _rates;
+    phase _phase;
+    unsigned int _probes;
+
+    // search ranges, [lo, hi] of the option indexes
+    size_t _vlo, _vhi, _vidx;
+    size_t _rlo, _rhi, _ridx;
+    int _good_ridx;     // highest rate seen with two periods, -1 for none
+    uint64_t _rate;
+    uint64_t _orig_rate;
+    uint64_t _min_rate;
+
+    double _level;      // mv of the 50% level
+    uint8_t _trigger;
+    double _frequency;
+};
+
+#endif  // _AUTOSET_H_
@@ -0,0 +1,181 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "averager.h"
+
+// fraction bits of the exponential accumulator
+static const unsigned int ExpFraction = 16;
+
+Averager::Averager() :
+        _mode(Off),
+        _requested(DefaultCount),
+        _count(DefaultCount),
+        _shift(4),
+        _frames(0),
+        _seeded(false)
+{
+}
+
+Averager::mode Averager::get_mode() const
+{
+    return _mode;
+}
+
+void Averager::set_mode(mode m)
+{
+    _mode = m;
+    set_count(_requested);
+}
+
+unsigned int Averager::get_count() const
+{
+    return _count;
+}
+
+void Averager::set_count(unsigned int count)
+{
+    assert(count > 0 && count <= MaxCount);
+    _requested = count;
+    _shift = 0;
+    while ((1u << _shift) < count)
+        _shift++;
+    _count = (_mode == Exponential) ? (1u << _shift) : count;
+    reset();
+}
+
+void Averager::reset()
+{
+    _frames = 0;
+    _seeded = false;
+    std::fill(_acc.begin(), _acc.end(), 0);
+}
+
+bool Averager::empty() const
+{
+    return !_seeded;
+}
+
+bool Averager::add(const uint8_t *data, size_t len)
+{
+    if (len != _acc.size()) {
+        _acc.assign(len, 0);
+        reset();
+    }
+
+    if (_mode == Exponential)
+        add_exponential(data, len);
+    else
+        add_block(data, len);
+    _seeded = true;
+    _frames++;
+    return ready();
+}
+
+bool Averager::ready() const
+{
+    return _frames >= _count;
+}
+
+size_t Averager::length() const
+{
+    return _acc.size();
+}
+
+float Averager::unit() const
+{
+    if (_mode == Exponential)
+        return 1.0f / (1u << ExpFraction);
+    return 1.0f / _frames;
+}
+
+void Averager::to_float(float *dst, size_t offset, size_t n, float scale) const
+{
+    assert(offset + n <= _acc.size());
+    const int32_t *acc = _acc.data() + offset;
+    const float base = 127.5f * scale;
+    const float step = unit() * scale;
+    for (size_t i = 0; i < n; i++)
+        dst[i] = base - acc[i] * step;
+}
+
+void Averager::to_raw(uint8_t *dst) const
+{
+    const float u = unit();
+    for (size_t i = 0; i < _acc.size(); i++) {
+        const long v = lrintf(_acc[i] * u);
+        dst[i] = (uint8_t)std::min(255L, std::max(0L, v));
+    }
+}
+
+void Averager::consume()
+{
+    // the running average continues, only the block sum starts over
+    if (_mode == Exponential)
+        _frames = 0;
+    else
+        reset();
+}
+
+// acc += x, 255 * MaxCount fits 32 bits
+void Averager::add_block(const uint8_t *data, size_t len)
+{
+    int32_t *acc = _acc.data();
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+        const __m128i lo = _mm_unpacklo_epi8(x, zero);
+        const __m128i hi = _mm_unpackhi_epi8(x, zero);
+        __m128i *a = (__m128i *)(acc + i);
+        _mm_storeu_si128(a + 0, _mm_add_epi32(_mm_loadu_si128(a + 0), _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+#endif
+    for (; i < len; i++)
+        acc[i] += data[i];
+}
+
+// acc += ((x << 16) - acc) >> shift, seeded with the first frame
+void Averager::add_exponential(const uint8_t *data, size_t len)
+{
+    int32_t *acc = _acc.data();
+    if (!_seeded) {
+        for (size_t i = 0; i < len; i++)
+            acc[i] = (int32_t)data[i] << ExpFraction;
+        return;
+    }
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i shift = _mm_cvtsi32_si128(_shift);
+    for (; i + 16 <= len; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+        const __m128i lo = _mm_unpacklo_epi8(x, zero);
+        const __m128i hi = _mm_unpackhi_epi8(x, zero);
+        const __m128i w[4] = {
+            _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)
+        };
+        __m128i *a = (__m128i *)(acc + i);
+        for (int j = 0; j < 4; j++) {
+            const __m128i v = _mm_loadu_si128(a + j);
+            const __m128i d = _mm_sub_epi32(_mm_slli_epi32(w[j], ExpFraction), v);
+            _mm_storeu_si128(a + j, _mm_add_epi32(v, _mm_sra_epi32(d, shift)));
+        }
+    }
+#endif
+    for (; i < len; i++)
+        acc[i] += (((int32_t)data[i] << ExpFraction) - acc[i]) >> _shift;
+}
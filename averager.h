@@ -0,0 +1,93 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _AVERAGER_H_
+#define _AVERAGER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Coherent averaging of trigger aligned raw frames.
+ *
+ * The 8 bit samples are summed into an integer accumulator with widening
+ * SIMD adds, no float work is done per input frame. Block mode outputs
+ * the mean of every count frames and starts over. Exponential mode keeps
+ * a running average in 16.16 fixed point with the weight 1/count of the
+ * newest frame, it is seeded with the first frame and also outputs one
+ * frame per count. Either way the output rate drops by count and the
+ * uncorrelated noise by sqrt(count).
+ */
+class Averager
+{
+public:
+    enum mode {
+        Off,
+        Block,
+        Exponential
+    };
+
+    static const unsigned int DefaultCount = 16;
+    static const unsigned int MaxCount = 65536;
+
+public:
+    Averager();
+
+    mode get_mode() const;
+    void set_mode(mode m);
+
+    /**
+     * Frames per output frame, 1 to MaxCount.
+     * Exponential mode rounds it up to a power of two.
+     */
+    unsigned int get_count() const;
+    void set_count(unsigned int count);
+
+    // drop everything accumulated
+    void reset();
+
+    // nothing accumulated since the last reset
+    bool empty() const;
+
+    /**
+     * Accumulate one frame, a frame of another length starts over.
+     * @return true when an averaged frame is ready
+     */
+    bool add(const uint8_t *data, size_t len);
+
+    bool ready() const;
+
+    // samples per frame of the current average
+    size_t length() const;
+
+    /**
+     * Write samples [offset, offset + n) of the averaged frame converted
+     * like the plain frames, (127.5 - sample) * scale.
+     */
+    void to_float(float *dst, size_t offset, size_t n, float scale) const;
+
+    // write the averaged frame rounded back to raw samples
+    void to_raw(uint8_t *dst) const;
+
+    // the averaged frame was output, accumulate the next one
+    void consume();
+
+private:
+    void add_block(const uint8_t *data, size_t len);
+    void add_exponential(const uint8_t *data, size_t len);
+
+    // raw sample value of one accumulator unit
+    float unit() const;
+
+private:
+    mode _mode;
+    unsigned int _requested;
+    unsigned int _count;
+    unsigned int _shift;
+    unsigned int _frames;
+    bool _seeded;
+    std::vector<int32_t> _acc;
+};
+
+#endif  // _AVERAGER_H_
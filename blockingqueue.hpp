@@ -5,20 +5,29 @@
 #ifndef _BLOCKINGQUEUE_H_
 #define _BLOCKINGQUEUE_H_
 
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
-#include <deque>
+#include <utility>
+#include <vector>
 #include <assert.h>
 
+// The elements live in a ring that only grows when it is full, so a queue
+// that has reached its high-water mark never allocates again.
 template <typename T>
 class BlockingQueue {
 public:
     using MutexLockGuard = std::lock_guard<std::mutex>;
 
-    BlockingQueue()
+    static const size_t DefaultCapacity = 64;
+
+    explicit BlockingQueue(size_t capacity = DefaultCapacity)
             : _mutex(),
               _notEmpty(),
-              _queue()
+              _ring(capacity > 0 ? capacity : 1),
+              _head(0),
+              _count(0),
+              _highWater(0)
     {
     }
 
@@ -29,7 +38,7 @@ public:
     {
         {
             MutexLockGuard lock(_mutex);
-            _queue.push_back(x);
+            push_back(T(x));
         }
         _notEmpty.notify_one();
     }
@@ -38,7 +47,7 @@ public:
     {
         {
             MutexLockGuard lock(_mutex);
-            _queue.push_back(std::move(x));
+            push_back(std::move(x));
         }
         _notEmpty.notify_one();
     }
@@ -46,25 +55,125 @@ public:
     T take()
     {
         std::unique_lock<std::mutex> lock(_mutex);
-        _notEmpty.wait(lock, [this]{  return !this->_queue.empty(); });
-        assert(!_queue.empty());
+        _notEmpty.wait(lock, [this]{  return this->_count != 0; });
+        assert(_count != 0);
+
+        return pop_front();
+    }
 
-        T front(std::move(_queue.front()));
-        _queue.pop_front();
+    bool try_take(T &x)
+    {
+        MutexLockGuard lock(_mutex);
+        if (_count == 0)
+            return false;
 
-        return  front;
+        x = pop_front();
+        return true;
+    }
+
+    // wait at most timeout for an element, woken as soon as one is put
+    template <typename Rep, typename Period>
+    bool take_for(T &x, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_notEmpty.wait_for(lock, timeout, [this]{  return this->_count != 0; }))
+            return false;
+
+        x = pop_front();
+        return true;
+    }
+
+    /**
+     * Move up to max_elems queued elements to the back of out without
+     * blocking, in one lock. Stops before the summed weigh() of the moved
+     * elements would exceed max_weight, the first element is always taken.
+     */
+    template <typename Container, typename Weigh>
+    size_t drain(Container &out, size_t max_elems, size_t max_weight, Weigh weigh)
+    {
+        MutexLockGuard lock(_mutex);
+        size_t count = 0;
+        size_t weight = 0;
+        while (count < max_elems && _count != 0) {
+            const size_t w = weigh(_ring[_head]);
+            if (count > 0 && weight + w > max_weight)
+                break;
+            weight += w;
+            out.push_back(pop_front());
+            count++;
+        }
+        return count;
+    }
+
+    void clear()
+    {
+        MutexLockGuard lock(_mutex);
+        while (_count != 0)
+            pop_front();
     }
 
     size_t size() const
     {
         MutexLockGuard lock(_mutex);
-        return _queue.size();
+        return _count;
+    }
+
+    size_t capacity() const
+    {
+        MutexLockGuard lock(_mutex);
+        return _ring.size();
+    }
+
+    // the largest size() since construction or the last reset
+    size_t high_water() const
+    {
+        MutexLockGuard lock(_mutex);
+        return _highWater;
+    }
+
+    void reset_high_water()
+    {
+        MutexLockGuard lock(_mutex);
+        _highWater = _count;
+    }
+
+private:
+    void push_back(T &&x)
+    {
+        if (_count == _ring.size())
+            grow();
+        _ring[(_head + _count) % _ring.size()] = std::move(x);
+        _count++;
+        if (_count > _highWater)
+            _highWater = _count;
+    }
+
+    T pop_front()
+    {
+        T front(std::move(_ring[_head]));
+        // drop what the moved-from slot may still hold
+        _ring[_head] = T();
+        _head = (_head + 1) % _ring.size();
+        _count--;
+        return front;
+    }
+
+    void grow()
+    {
+        std::vector<T> ring(_ring.size() * 2);
+        for (size_t i = 0; i < _count; i++)
+            ring[i] = std::move(_ring[(_head + i) % _ring.size()]);
+        _ring.swap(ring);
+        _head = 0;
     }
 
 private:
     mutable std::mutex _mutex;
     std::condition_variable _notEmpty;
-    std::deque<T> _queue;
+    std::vector<T> _ring;
+    size_t _head;
+    size_t _count;
+    size_t _highWater;
 };
 
-#endif  // _BLOCKINGQUEUE_H_
\ No newline at end of file
+#endif  // _BLOCKINGQUEUE_H_
@@ -23,6 +23,7 @@
 #include <sstream>
 #include <iostream>
 #include "device.h"
+#include "logbridge.h"
 
 using std::ostringstream;
 using std::string;
@@ -123,7 +124,7 @@ void Device::set_ch_enable(int ch_index, bool enable) {
         cur_enable = g_variant_get_boolean(gvar);
         g_variant_unref(gvar);
     } else {
-        std::cout << "ERROR: config_get SR_CONF_EN_CH failed." << std::endl;
+        DS_LOG(SR_LOG_ERR, "config_get SR_CONF_EN_CH failed.");
         return;
     }
     if (cur_enable == enable)
@@ -28,6 +28,7 @@
 #include "devinst.h"
 #include "device.h"
 #include "sigsession.h"
+#include "logbridge.h"
 
 #include <cassert>
 #include <sstream>
@@ -54,7 +55,7 @@ using std::string;
 
     DeviceManager::~DeviceManager()
     {
-        std::cout << __func__ << " has been called!" << std::endl;
+        DS_LOG(SR_LOG_DBG, "%s has been called!", __func__);
         release_devices();
     }
 
@@ -0,0 +1,208 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <cassert>
+#include <stdexcept>
+
+#include "devicepool.h"
+#include "devicemanager.h"
+#include "sigsession.h"
+#include "logbridge.h"
+
+using std::runtime_error;
+using std::string;
+
+boost::mutex DevicePool::_mutex;
+DevicePool *DevicePool::_pool = NULL;
+
+// closes the warm device when the module is unloaded
+static struct PoolReaper {
+    ~PoolReaper() { DevicePool::shutdown(); }
+} reaper;
+
+DevicePool::Lease::Lease(DevicePool &pool) :
+        _pool(pool)
+{
+}
+
+DevicePool::Lease::~Lease()
+{
+    boost::lock_guard<boost::mutex> lock(DevicePool::_mutex);
+    _pool.release(this);
+}
+
+SigSession &DevicePool::Lease::session() const
+{
+    return *_pool._session;
+}
+
+BlockingQueue<DsoFrame> &DevicePool::Lease::queue() const
+{
+    return *_pool._dso_queue;
+}
+
+boost::shared_ptr<DevInst> DevicePool::Lease::get_device() const
+{
+    return _pool._session->get_device();
+}
+
+bool DevicePool::Lease::claim()
+{
+    boost::lock_guard<boost::mutex> lock(DevicePool::_mutex);
+    if (_pool._consumer != NULL && _pool._consumer != this)
+        return false;
+    if (_pool._consumer == NULL)
+        _pool._dso_queue->clear();
+    _pool._consumer = this;
+    return true;
+}
+
+void DevicePool::Lease::unclaim()
+{
+    boost::lock_guard<boost::mutex> lock(DevicePool::_mutex);
+    if (_pool._consumer == this)
+        _pool._consumer = NULL;
+}
+
+DevicePool::DevicePool() :
+        _refs(0),
+        _consumer(NULL),
+        _sr_ctx(NULL),
+        _device_manager(NULL),
+        _session(NULL),
+        _dso_queue(NULL)
+{
+}
+
+DevicePool::~DevicePool()
+{
+    close();
+}
+
+boost::shared_ptr<DevicePool::Lease> DevicePool::lease(const string &driver)
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+
+    if (_pool == NULL)
+        _pool = new DevicePool();
+
+    if (_pool->_session == NULL) {
+        _pool->open(driver);
+    } else if (_pool->_driver != driver) {
+        throw runtime_error("ERROR: device " + _pool->_driver + " already opened!");
+    }
+
+    _pool->_refs++;
+    return boost::shared_ptr<Lease>(new Lease(*_pool));
+}
+
+void DevicePool::shutdown()
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+
+    if (_pool == NULL || _pool->_refs > 0)
+        return;
+
+    delete _pool;
+    _pool = NULL;
+}
+
+int DevicePool::use_count()
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    return _pool ? _pool->_refs : 0;
+}
+
+void DevicePool::open(const string &driver)
+{
+    // libsigrok logs from the capture threads, keep the console off them
+    sr_log_callback_set(LogBridge::sr_log_handler, NULL);
+
+    // Initialise libsigrok
+    if (sr_init(&_sr_ctx) != SR_OK) {
+        _sr_ctx = NULL;
+        throw runtime_error("ERROR: libsigrok init failed for the first time!");
+    }
+
+    try {
+        _dso_queue = new BlockingQueue<DsoFrame>();
+        _device_manager = new DeviceManager(_sr_ctx);
+        _session = new SigSession(*_device_manager, *_dso_queue);
+    } catch (...) {
+        close();
+        throw;
+    }
+
+    _session->set_default_device();
+
+    if (!_session->get_device() || _session->get_device()->name() != driver) {
+        DS_LOG(SR_LOG_ERR, "device %s not found!", driver.c_str());
+        close();
+        throw runtime_error("ERROR: device " + driver + " not found!");
+    }
+
+    ds_trigger_init();
+
+    _session->get_device()->set_ch_enable(1, false);
+    _session->get_device()->set_limit_samples(2048);
+
+    // re-attached hardware resumes where it was unplugged
+    _session->register_hotplug_callback();
+    _session->start_hotplug_proc();
+    _session->start_watchdog();
+
+    _driver = driver;
+}
+
+// The device must be released from the session before the device manager
+// clears the drivers, and the session must go after the device manager or
+// the sampling thread will lock-up.
+void DevicePool::close()
+{
+    if (_session != NULL) {
+        // the watchdog may re-open the device, stop it first
+        _session->stop_watchdog();
+        _session->stop_hotplug_proc();
+        _session->deregister_hotplug_callback();
+        _session->stop_capture();
+        _session->set_device(boost::shared_ptr<DevInst>());
+    }
+
+    if (_device_manager != NULL) {
+        DS_LOG(SR_LOG_DBG, "destructing device manager.");
+        delete _device_manager;
+        _device_manager = NULL;
+    }
+
+    if (_session != NULL) {
+        DS_LOG(SR_LOG_DBG, "destructing session.");
+        delete _session;
+        _session = NULL;
+    }
+
+    if (_dso_queue != NULL) {
+        DS_LOG(SR_LOG_DBG, "destructing dso_queue.");
+        delete _dso_queue;
+        _dso_queue = NULL;
+    }
+
+    if (_sr_ctx != NULL) {
+        sr_exit(_sr_ctx);
+        _sr_ctx = NULL;
+    }
+    sr_log_callback_set_default();
+
+    _driver.clear();
+}
+
+void DevicePool::release(Lease *lease)
+{
+    assert(_refs > 0);
+
+    if (_consumer == lease)
+        _consumer = NULL;
+
+    // keep the device open and warm, only the capture is stopped
+    if (--_refs == 0 && _session != NULL)
+        _session->stop_capture();
+}
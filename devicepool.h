@@ -0,0 +1,93 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _DEVICEPOOL_H_
+#define _DEVICEPOOL_H_
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <libsigrok4DSL/libsigrok.h>
+#include "blockingqueue.hpp"
+#include "dsoframe.h"
+
+class DeviceManager;
+class SigSession;
+class DevInst;
+
+/**
+ * Process wide owner of the libsigrok context, the device manager and the
+ * capture session.
+ *
+ * libsigrok4DSL only supports one session per process, so every block
+ * instance leases the same opened device from the pool. The hardware stays
+ * open (warm) after the last lease is dropped, a new block re-uses it
+ * without another init/scan/open cycle. Everything is torn down in a fixed
+ * order by shutdown(), which runs automatically when the module unloads.
+ */
+class DevicePool
+{
+public:
+    class Lease
+    {
+    public:
+        ~Lease();
+
+        SigSession &session() const;
+        BlockingQueue<DsoFrame> &queue() const;
+        boost::shared_ptr<DevInst> get_device() const;
+
+        /**
+         * Make this lease the consumer of the capture queue.
+         * Only one lease can consume at a time, returns false if another
+         * lease already claimed the session.
+         */
+        bool claim();
+        void unclaim();
+
+    private:
+        friend class DevicePool;
+        explicit Lease(DevicePool &pool);
+
+        DevicePool &_pool;
+    };
+
+public:
+    /**
+     * Lease the device named driver, opening it on first use.
+     * Throws std::runtime_error if libsigrok or the device fails to open.
+     */
+    static boost::shared_ptr<Lease> lease(const std::string &driver);
+
+    /**
+     * Close the device and release the libsigrok context.
+     * Does nothing while leases are still held.
+     */
+    static void shutdown();
+
+    static int use_count();
+
+private:
+    DevicePool();
+    ~DevicePool();
+
+    void open(const std::string &driver);
+    void close();
+    void release(Lease *lease);
+
+private:
+    static boost::mutex _mutex;
+    static DevicePool *_pool;
+
+    int _refs;
+    Lease *_consumer;
+    std::string _driver;
+
+    struct sr_context *_sr_ctx;
+    DeviceManager *_device_manager;
+    SigSession *_session;
+    BlockingQueue<DsoFrame> *_dso_queue;
+};
+
+#endif  // _DEVICEPOOL_H_
@@ -26,6 +26,8 @@
 
 
 #include "sigsession.h"
+#include "tracer.h"
+#include "logbridge.h"
 
 //namespace pv {
 //namespace device {
@@ -72,6 +74,7 @@ DevInst::DevInst() :
     _usable(true)
 {
     _id = malloc(1);
+    invalidate_config_cache();
 }
 
 DevInst::~DevInst()
@@ -109,6 +112,7 @@ SigSession* DevInst::owner() const
 
 GVariant* DevInst::get_config(const sr_channel *ch, const sr_channel_group *group, int key)
 {
+    TRACE_SCOPE("get_config");
 	GVariant *data = NULL;
 	assert(_owner);
 	sr_dev_inst *const sdi = dev_inst();
@@ -121,13 +125,16 @@ GVariant* DevInst::get_config(const sr_channel *ch, const sr_channel_group *grou
 bool DevInst::set_config(sr_channel *ch, sr_channel_group *group, int key, GVariant *data)
 {
 	//print_backtrace();
+    TRACE_SCOPE("set_config");
 	assert(_owner);
 	sr_dev_inst *const sdi = dev_inst();
 	assert(sdi);
-    if(sr_config_set(sdi, ch, group, key, data) == SR_OK) {
-		return true;
-	}
-	return false;
+    // the driver may round the value or derive other settings from it
+    // (the time base sets the sample rate), read all back on the next get
+    boost::lock_guard<boost::mutex> lock(_cache_mutex);
+    for (int i = 0; i < ConfigCacheCount; i++)
+        _cache_valid[i] = false;
+    return sr_config_set(sdi, ch, group, key, data) == SR_OK;
 }
 
 GVariant* DevInst::list_config(const sr_channel_group *group, int key)
@@ -158,41 +165,17 @@ void DevInst::enable_probe(const sr_channel *probe, bool enable)
 
 uint64_t DevInst::get_sample_limit()
 {
-	uint64_t sample_limit;
-    GVariant* gvar = get_config(NULL, NULL, SR_CONF_LIMIT_SAMPLES);
-	if (gvar != NULL) {
-		sample_limit = g_variant_get_uint64(gvar);
-		g_variant_unref(gvar);
-	} else {
-		sample_limit = 0U;
-	}
-	return sample_limit;
+    return get_cached_config(SampleLimitCache, NULL, SR_CONF_LIMIT_SAMPLES);
 }
 
 uint64_t DevInst::get_sample_rate()
 {
-    uint64_t sample_rate;
-    GVariant* gvar = get_config(NULL, NULL, SR_CONF_SAMPLERATE);
-    if (gvar != NULL) {
-        sample_rate = g_variant_get_uint64(gvar);
-        g_variant_unref(gvar);
-    } else {
-        sample_rate = 0U;
-    }
-    return sample_rate;
+    return get_cached_config(SampleRateCache, NULL, SR_CONF_SAMPLERATE);
 }
 
 uint64_t DevInst::get_time_base()
 {
-    uint64_t time_base;
-    GVariant* gvar = get_config(NULL, NULL, SR_CONF_TIMEBASE);
-    if (gvar != NULL) {
-        time_base = g_variant_get_uint64(gvar);
-        g_variant_unref(gvar);
-    } else {
-        time_base = 0U;
-    }
-    return time_base;
+    return get_cached_config(TimeBaseCache, NULL, SR_CONF_TIMEBASE);
 }
 
 
@@ -272,7 +255,7 @@ void DevInst::set_ch_enable(int ch_index, bool enable) {
         cur_enable = g_variant_get_boolean(gvar);
         g_variant_unref(gvar);
     } else {
-        std::cout << "ERROR: config_get SR_CONF_EN_CH failed." << std::endl;
+        DS_LOG(SR_LOG_ERR, "config_get SR_CONF_EN_CH failed.");
         return;
     }
     if (cur_enable == enable)
@@ -281,50 +264,77 @@ void DevInst::set_ch_enable(int ch_index, bool enable) {
     set_config(ch, NULL, SR_CONF_EN_CH, g_variant_new_boolean(enable));
 */
 	enable_probe(ch, enable);
+	invalidate_config_cache();
 }
 
 void DevInst::set_sample_rate(uint64_t sample_rate)
 {
-    set_config(NULL, NULL,
-               SR_CONF_SAMPLERATE,
-               g_variant_new_uint64(sample_rate));
+    set_uint64_config(NULL, SR_CONF_SAMPLERATE, sample_rate);
 }
 
 void DevInst::set_limit_samples(uint64_t sample_count)
 {
-    set_config(NULL, NULL,
-               SR_CONF_LIMIT_SAMPLES,
-               g_variant_new_uint64(sample_count));
+    set_uint64_config(NULL, SR_CONF_LIMIT_SAMPLES, sample_count);
 }
 
 // unit mv
 void DevInst::set_voltage_div(int ch_index, uint64_t div) {
     sr_channel* ch=get_channel(ch_index);
     assert(ch);
-    set_config(ch, NULL, SR_CONF_PROBE_VDIV,
-                          g_variant_new_uint64(div));
+    set_uint64_config(ch, SR_CONF_PROBE_VDIV, div);
 }
 
 uint64_t DevInst::get_voltage_div(int ch_index) {
     sr_channel* ch=get_channel(ch_index);
     assert(ch);
-    uint64_t vdiv;
-    GVariant* gvar = get_config(ch, NULL, SR_CONF_PROBE_VDIV);
-    if (gvar != NULL) {
-        vdiv = g_variant_get_uint64(gvar);
-        g_variant_unref(gvar);
-    } else {
-        vdiv = 0U;
-    }
-    return vdiv;
+    return get_cached_config(VdivCache + ch_index, ch, SR_CONF_PROBE_VDIV);
 }
 
 // unit ns
 void DevInst::set_time_base(int ch_index, uint64_t ts) {
     sr_channel* ch=get_channel(ch_index);
     assert(ch);
-    set_config(ch, NULL, SR_CONF_TIMEBASE,
-               g_variant_new_uint64(ts));
+    set_uint64_config(ch, SR_CONF_TIMEBASE, ts);
+}
+
+// the raw sample value the dso trigger fires at
+void DevInst::set_trigger_value(int ch_index, uint8_t value) {
+    sr_channel* ch=get_channel(ch_index);
+    assert(ch);
+    set_config(ch, NULL, SR_CONF_TRIGGER_VALUE, g_variant_new_byte(value));
+}
+
+void DevInst::invalidate_config_cache()
+{
+    boost::lock_guard<boost::mutex> lock(_cache_mutex);
+    for (int i = 0; i < ConfigCacheCount; i++)
+        _cache_valid[i] = false;
+}
+
+uint64_t DevInst::get_cached_config(int cache_index, const sr_channel *ch, int key)
+{
+    assert(cache_index < ConfigCacheCount);
+    // a set_config() in between must not leave the old value cached
+    boost::lock_guard<boost::mutex> lock(_cache_mutex);
+    if (_cache_valid[cache_index])
+        return _cache_value[cache_index];
+
+    uint64_t value;
+    GVariant* gvar = get_config(ch, NULL, key);
+    if (gvar != NULL) {
+        value = g_variant_get_uint64(gvar);
+        g_variant_unref(gvar);
+        _cache_value[cache_index] = value;
+        _cache_valid[cache_index] = true;
+    } else {
+        value = 0U;
+    }
+    return value;
+}
+
+void DevInst::set_uint64_config(sr_channel *ch, int key, uint64_t value)
+{
+    set_config(ch, NULL, key, g_variant_new_uint64(value));
 }
 //} // device
 //} // pv
@@ -23,6 +23,7 @@
 #define DSVIEW_PV_DEVICE_DEVINST_H
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <string>
 #include <glib.h>
@@ -130,10 +131,38 @@ public:
 	virtual void set_voltage_div(int ch_index, uint64_t div);
 	virtual uint64_t get_voltage_div(int ch_index);
 	virtual void set_time_base(int ch_index, uint64_t ts);
+	virtual void set_trigger_value(int ch_index, uint8_t value);
+
+    /**
+     * @brief Forget the cached settings, the next get_* call reads them
+     * from the driver again. Every set_config() does it, the driver may
+     * derive other settings from the one set. Needed when the device was
+     * re-opened.
+     */
+    void invalidate_config_cache();
+
+private:
+    uint64_t get_cached_config(int cache_index, const sr_channel *ch, int key);
+    void set_uint64_config(sr_channel *ch, int key, uint64_t value);
+
 protected:
 	SigSession *_owner;
     void *_id;
     bool _usable;
+
+private:
+    // the uint64 settings read per frame, to avoid a GVariant per read,
+    // read and set from the block, sampling and watchdog threads
+    enum {
+        SampleRateCache,
+        SampleLimitCache,
+        TimeBaseCache,
+        VdivCache,
+        ConfigCacheCount = VdivCache + DS_MAX_DSO_PROBES_NUM
+    };
+    bool _cache_valid[ConfigCacheCount];
+    uint64_t _cache_value[ConfigCacheCount];
+    boost::mutex _cache_mutex;
 };
 
 //} // device
@@ -0,0 +1,42 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _DSOFRAME_H_
+#define _DSOFRAME_H_
+
+#include <memory>
+#include <stdint.h>
+#include <libsigrok4DSL/libsigrok.h>
+
+/**
+ * One dso packet as handed from the sampling thread to the block, tagged
+ * with the device configuration it was captured with.
+ * dso.data points into buffer, a FramePool buffer the packet was copied
+ * into, libsigrok re-uses its own transfer buffer.
+ */
+struct DsoFrame
+{
+    sr_datafeed_dso dso;
+    std::shared_ptr<uint8_t> buffer;
+    size_t bytes;
+
+    uint64_t samplerate;
+    uint64_t limit;
+    uint64_t vdiv;      // mv of channel 0
+
+    // first frame after a configuration change was applied
+    bool reconfigured;
+    // the last queue_config() generation applied before this frame
+    uint64_t config_gen;
+
+    // stamped in the sampling thread when the packet arrived
+    uint64_t seq;           // packet number since the capture started
+    uint64_t sample_pos;    // samples the device delivered before this one
+    int64_t timestamp_ns;   // wall clock, ns since the epoch
+
+    // samples are missing before this frame that the sequence does not
+    // show: overflow, dropped packet or a re-armed capture
+    bool discontinuity;
+};
+
+#endif  // _DSOFRAME_H_
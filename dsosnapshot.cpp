@@ -50,7 +50,9 @@ DsoSnapshot::DsoSnapshot() :
     Snapshot(sizeof(uint16_t), 1, 1),
     _envelope_en(false),
     _envelope_done(false),
-    _instant(false)
+    _instant(false),
+    _ring_write_limit(0),
+    _ring_reset_gen(0)
 {
 	memset(_envelope_levels, 0, sizeof(_envelope_levels));
 }
@@ -74,8 +76,7 @@ void DsoSnapshot::free_envelop()
 void DsoSnapshot::init()
 {
     boost::lock_guard<boost::recursive_mutex> lock(_mutex);
-    _sample_count = 0;
-    _ring_sample_count = 0;
+    reset_ring();
     _memory_failed = false;
     _last_ended = true;
     _envelope_done = false;
@@ -96,9 +97,21 @@ void DsoSnapshot::clear()
     init();
 }
 
+void DsoSnapshot::reset_ring()
+{
+    begin_write();
+    _ring_reset_gen.store(write_generation(), std::memory_order_relaxed);
+    // the new generation is visible before the counters restart
+    std::atomic_thread_fence(std::memory_order_release);
+    _ring_sample_count = 0;
+    _ring_write_limit = 0;
+    publish(0, false);
+}
+
 void DsoSnapshot::first_payload(const sr_datafeed_dso &dso, uint64_t total_sample_count,
-                                std::map<int, bool> ch_enable, bool instant)
+                                const std::map<int, bool> &ch_enable, bool instant)
 {
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
     bool re_alloc = false;
     unsigned int channel_num = 0;
     for (auto& iter:ch_enable) {
@@ -114,14 +127,18 @@ void DsoSnapshot::first_payload(const sr_datafeed_dso &dso, uint64_t total_sampl
     _total_sample_count = total_sample_count;
     _channel_num = channel_num;
     _instant = instant;
-    _ch_enable = ch_enable;
+    if (instant) {
+        // a new roll starts at the head of the ring
+        reset_ring();
+    }
+    if (_ch_enable != ch_enable)
+        _ch_enable = ch_enable;
 
     bool isOk = true;
     uint64_t size = _total_sample_count * _channel_num + sizeof(uint64_t);
     if (re_alloc || size != _capacity) {
-        free_data();
-        _data = malloc(size);
-        if (_data) {
+        _sample_count = 0;
+        if (reserve_data(size)) {
             free_envelop();
             for (unsigned int i = 0; i < _channel_num; i++) {
                 uint64_t envelop_count = _total_sample_count / EnvelopeScaleFactor;
@@ -139,7 +156,7 @@ void DsoSnapshot::first_payload(const sr_datafeed_dso &dso, uint64_t total_sampl
                     break;
             }
         } else {
-            isOk = true;
+            isOk = false;
         }
     }
 
@@ -170,14 +187,33 @@ void DsoSnapshot::append_payload(const sr_datafeed_dso &dso)
 
 void DsoSnapshot::append_data(void *data, uint64_t samples, bool instant)
 {
+    begin_write();
     if (instant) {
-        memcpy((uint8_t*)_data + _sample_count * _channel_num, data, samples*_channel_num);
-        _sample_count = (_sample_count + samples) % (_total_sample_count + 1);
+        const uint64_t ring = _total_sample_count + 1;
+        uint64_t pos = _ring_sample_count.load(std::memory_order_relaxed);
+        const uint8_t *src = (const uint8_t*)data;
+        if (samples > ring) {
+            // only the tail fits
+            src += (samples - ring) * _channel_num;
+            pos += samples - ring;
+            samples = ring;
+        }
+
+        // views reaching below the new limit - ring are overwritten from here
+        _ring_write_limit.store(pos + samples, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        const uint64_t slot = pos % ring;
+        const uint64_t head = min(samples, ring - slot);
+        memcpy((uint8_t*)_data + slot * _channel_num, src, head * _channel_num);
+        memcpy((uint8_t*)_data, src + head * _channel_num, (samples - head) * _channel_num);
+        _ring_sample_count.store(pos + samples, std::memory_order_release);
+        publish((slot + samples) % ring, false);
     } else {
-        memcpy((uint8_t*)_data, data, samples*_channel_num);
-        _sample_count = samples;
+        // readers keep the previous frame until this one is complete
+        memcpy((uint8_t*)back_data(), data, samples*_channel_num);
+        publish(samples, true);
     }
-
 }
 
 void DsoSnapshot::enable_envelope(bool enable)
@@ -206,6 +242,65 @@ const uint8_t *DsoSnapshot::get_samples(
     return (uint8_t*)_data + start_sample * _channel_num + index * (_channel_num != 1);
 }
 
+bool DsoSnapshot::get_view(uint64_t start, uint64_t end, sample_view &view) const
+{
+    view = sample_view();
+    if (start > end)
+        return false;
+
+    const frame_ref frame = acquire_frame();
+    if (!frame.data)
+        return false;
+
+    const uint8_t *base = (const uint8_t*)frame.data;
+    view.start = start;
+    view.count = end - start;
+    view.stride = _channel_num;
+    view._frame = frame;
+    view._base = frame.data;
+    view._ring = _instant;
+
+    if (!view._ring) {
+        if (end > frame.sample_count)
+            return false;
+        view.first.data = base + start * view.stride;
+        view.first.count = view.count;
+        view.second.data = base;
+        return true;
+    }
+
+    const uint64_t ring = _total_sample_count + 1;
+    view._ring_gen = _ring_reset_gen.load(std::memory_order_acquire);
+    const uint64_t written = _ring_sample_count.load(std::memory_order_acquire);
+    if (end > written || start + ring < written)
+        return false;
+
+    const uint64_t slot = start % ring;
+    view.first.data = base + slot * view.stride;
+    view.first.count = min(view.count, ring - slot);
+    view.second.data = base;
+    view.second.count = view.count - view.first.count;
+    return true;
+}
+
+bool DsoSnapshot::view_valid(const sample_view &view) const
+{
+    if (!view._ring)
+        return frame_valid(view._frame);
+
+    // order the sample reads before the checks
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _ring_reset_gen.load(std::memory_order_relaxed) == view._ring_gen &&
+           _ring_write_limit.load(std::memory_order_relaxed) <=
+                view.start + _total_sample_count + 1 &&
+           acquire_frame().data == view._base;
+}
+
+uint64_t DsoSnapshot::get_ring_position() const
+{
+    return _ring_sample_count.load(std::memory_order_acquire);
+}
+
 void DsoSnapshot::get_envelope_section(EnvelopeSection &s,
     uint64_t start, uint64_t end, float min_length, int probe_index) const
 {
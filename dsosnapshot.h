@@ -23,6 +23,9 @@
 #ifndef DSVIEW_PV_DATA_DSOSNAPSHOT_H
 #define DSVIEW_PV_DATA_DSOSNAPSHOT_H
 
+#include <assert.h>
+#include <cstddef>
+#include <iterator>
 #include <utility>
 #include <vector>
 
@@ -53,6 +56,130 @@ public:
 		EnvelopeSample *samples;
 	};
 
+    /**
+     * Contiguous run of interleaved samples, stride bytes per sample.
+     */
+    struct sample_span
+    {
+        const uint8_t *data;
+        uint64_t count;
+    };
+
+    /**
+     * A logical sample range read in place. In instant mode the range
+     * is split in two spans where it crosses the end of the ring,
+     * otherwise second is empty. Take and read it under a read_guard,
+     * check view_valid() after reading.
+     */
+    class sample_view
+    {
+    public:
+        // walks one channel across both spans
+        class iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef uint8_t value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const uint8_t *pointer;
+            typedef const uint8_t &reference;
+
+            iterator() :
+                _ptr(NULL), _end(NULL), _next(NULL), _next_end(NULL), _stride(1) {}
+            iterator(const uint8_t *ptr, const uint8_t *end,
+                     const uint8_t *next, const uint8_t *next_end, unsigned int stride) :
+                _ptr(ptr), _end(end), _next(next), _next_end(next_end), _stride(stride) {}
+
+            reference operator*() const { return *_ptr; }
+            iterator &operator++()
+            {
+                _ptr += _stride;
+                if (_ptr == _end && _next) {
+                    _ptr = _next;
+                    _end = _next_end;
+                    _next = NULL;
+                }
+                return *this;
+            }
+            iterator operator++(int) { iterator it(*this); ++(*this); return it; }
+            bool operator==(const iterator &it) const { return _ptr == it._ptr; }
+            bool operator!=(const iterator &it) const { return _ptr != it._ptr; }
+
+        private:
+            const uint8_t *_ptr;
+            const uint8_t *_end;
+            const uint8_t *_next;
+            const uint8_t *_next_end;
+            unsigned int _stride;
+        };
+
+    public:
+        sample_view() :
+            start(0), count(0), stride(1), _base(NULL), _ring(false), _ring_gen(0)
+        {
+            first.data = second.data = NULL;
+            first.count = second.count = 0;
+        }
+
+        bool empty() const { return count == 0; }
+
+        iterator begin(uint16_t index) const
+        {
+            if (empty())
+                return iterator();
+            const unsigned int off = index % stride;
+            return iterator(first.data + off, first.data + first.count * stride + off,
+                            second.count ? second.data + off : NULL,
+                            second.data + second.count * stride + off, stride);
+        }
+
+        iterator end(uint16_t index) const
+        {
+            if (empty())
+                return iterator();
+            const unsigned int off = index % stride;
+            if (second.count)
+                return iterator(second.data + second.count * stride + off, NULL, NULL, NULL, stride);
+            return iterator(first.data + first.count * stride + off, NULL, NULL, NULL, stride);
+        }
+
+        /**
+         * Call f(const uint8_t *data, uint64_t count) on consecutive
+         * contiguous pieces of at most max_samples samples each. A piece
+         * never crosses the wrap, so f can run vector loops on it.
+         */
+        template <typename F>
+        void for_each_chunk(uint64_t max_samples, F f) const
+        {
+            assert(max_samples > 0);
+            const sample_span *spans[2] = {&first, &second};
+            for (int i = 0; i < 2; i++) {
+                const uint8_t *data = spans[i]->data;
+                uint64_t left = spans[i]->count;
+                while (left > 0) {
+                    const uint64_t n = left < max_samples ? left : max_samples;
+                    f(data, n);
+                    data += n * stride;
+                    left -= n;
+                }
+            }
+        }
+
+    public:
+        sample_span first;
+        sample_span second;
+        uint64_t start;
+        uint64_t count;
+        unsigned int stride;
+
+    private:
+        friend class DsoSnapshot;
+        Snapshot::frame_ref _frame;
+        const void *_base;
+        bool _ring;
+        uint64_t _ring_gen;
+    };
+
 private:
 	struct Envelope
 	{
@@ -78,13 +205,25 @@ public:
     void clear();
     void init();
 
-    void first_payload(const sr_datafeed_dso &dso, uint64_t total_sample_count, std::map<int, bool> ch_enable, bool instant);
+    void first_payload(const sr_datafeed_dso &dso, uint64_t total_sample_count, const std::map<int, bool> &ch_enable, bool instant);
 
     void append_payload(const sr_datafeed_dso &dso);
 
     const uint8_t* get_samples(int64_t start_sample,
         int64_t end_sample, uint16_t index) const;
 
+    /**
+     * View of the samples [start, end) without copying. In instant mode
+     * positions count from the start of the capture, readable while
+     * they are still in the ring; otherwise they index the last frame.
+     * Returns false if the range is not (or no longer) available.
+     */
+    bool get_view(uint64_t start, uint64_t end, sample_view &view) const;
+    bool view_valid(const sample_view &view) const;
+
+    // logical position of the next ring sample to be written
+    uint64_t get_ring_position() const;
+
 	void get_envelope_section(EnvelopeSection &s,
         uint64_t start, uint64_t end, float min_length, int probe_index) const;
 
@@ -97,6 +236,7 @@ public:
 
 private:
     void append_data(void *data, uint64_t samples, bool instant);
+    void reset_ring();
     void free_envelop();
 	void reallocate_envelope(Envelope &l);
     void append_payload_to_envelope_levels(bool header);
@@ -105,7 +245,10 @@ private:
     struct Envelope _envelope_levels[2*DS_MAX_DSO_PROBES_NUM][ScaleStepCount];
     bool _envelope_en;
     bool _envelope_done;
-    bool _instant;
+    std::atomic<bool> _instant;
+    std::atomic<uint64_t> _ring_write_limit;
+    // write generation of the last ring reset, ring views of an older one are invalid
+    std::atomic<uint64_t> _ring_reset_gen;
     std::map<int, bool> _ch_enable;
 
 //    friend class DsoSnapshotTest::Basic;
@@ -0,0 +1,173 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+// Checks of the frame processing classes on synthetic frames, they need
+// neither a device nor Pothos. Returns non-zero when a check failed.
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "spectrum.h"
+#include "measurement.h"
+#include "masktest.h"
+#include "averager.h"
+#include "autoset.h"
+using namespace std;
+
+static int failed = 0;
+
+static void report(const char *name, bool ok)
+{
+    cout << name << ": " << (ok ? "ok" : "FAILED") << endl;
+    if (!ok)
+        failed++;
+}
+
+// raw samples of a sine of amplitude mv peak at vdiv, cycles per sample
+static vector<uint8_t> sine(size_t len, double cycles, double mv, uint64_t vdiv)
+{
+    vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; i++) {
+        const double raw = 127.5 - mv * 25.6 / vdiv * sin(2 * M_PI * cycles * i);
+        data[i] = (uint8_t)std::min(255.0, std::max(0.0, round(raw)));
+    }
+    return data;
+}
+
+// a sine centered on bin 100 shows in bin 100 at its level in dBV
+static void check_spectrum()
+{
+    const size_t n = 4096;
+    const uint64_t vdiv = 1000;
+    const double mv = 2000;     // 2 V peak, +6.02 dBV
+    const vector<uint8_t> data = sine(n, 100.0 / n, mv, vdiv);
+
+    Spectrum spectrum;
+    spectrum.set_bins(n / 2);
+    bool ok = spectrum.add(data.data(), n, vdiv) && spectrum.size() == n;
+    vector<float> db(spectrum.bins());
+    spectrum.to_db(db.data());
+    const size_t peak = std::max_element(db.begin(), db.end()) - db.begin();
+    ok = ok && peak == 100 && fabs(db[peak] - 20 * log10(mv / 1000)) < 0.1;
+    report("spectrum sine bin and level", ok);
+}
+
+// 10 kHz at 1 MS/s, 30% duty at the 50% level, 10 sample linear edges
+// between raw 64 and 192, 8 samples from 10% to 90%
+static void check_measurement()
+{
+    const size_t period = 100, high = 30, ramp = 10, len = 2000;
+    vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; i++) {
+        const size_t t = i % period;
+        double x;
+        if (t < ramp)
+            x = (double)t / ramp;
+        else if (t < high)
+            x = 1;
+        else if (t < high + ramp)
+            x = 1 - (double)(t - high) / ramp;
+        else
+            x = 0;
+        // raw values count down as the voltage goes up
+        data[i] = (uint8_t)round(192 - 128 * x);
+    }
+
+    Measurement::result r;
+    const bool ok = Measurement::measure(data.data(), len, 1000000, 1000, r) &&
+                    fabs(r.frequency - 10000) < 10 &&
+                    fabs(r.duty - 30) < 1 &&
+                    fabs(r.rise_time - 8e-6) < 0.5e-6 &&
+                    fabs(r.fall_time - 8e-6) < 0.5e-6;
+    report("measurement square wave frequency, duty and rise time", ok);
+    if (!ok)
+        cout << "  frequency " << r.frequency << " duty " << r.duty
+             << " rise " << r.rise_time << " fall " << r.fall_time << endl;
+}
+
+// runs that cross the 16 sample blocks and the scalar tail stay whole
+static void check_mask_runs()
+{
+    const size_t len = 70;
+    const size_t starts[] = {14, 30, 47, 62};
+    const size_t lengths[] = {4, 5, 2, 8};
+    vector<uint8_t> data(len, 128);
+    for (int r = 0; r < 4; r++)
+        for (size_t i = starts[r]; i < starts[r] + lengths[r]; i++)
+            data[i] = 0;
+
+    MaskTest mask;
+    mask.set_mask(vector<double>(1, 1000), vector<double>(1, -1000));
+    MaskTest::result res;
+    bool ok = !mask.check(data.data(), len, 1000, res) && res.violations == 19 && res.runs == 4;
+    for (unsigned int r = 0; ok && r < res.runs; r++)
+        ok = res.run_start[r] == starts[r] && res.run_length[r] == lengths[r];
+    report("mask runs across the SSE blocks", ok);
+}
+
+static void check_averager()
+{
+    const size_t len = 40;
+    vector<uint8_t> rounded(len);
+    float out;
+
+    // the mean 10.75 rounds to 11
+    Averager block;
+    block.set_mode(Averager::Block);
+    block.set_count(4);
+    const uint8_t values[] = {10, 11, 11, 11};
+    bool ready = false;
+    for (uint8_t v : values)
+        ready = block.add(vector<uint8_t>(len, v).data(), len);
+    block.to_float(&out, len - 1, 1, 1.0f);
+    block.to_raw(rounded.data());
+    report("block average rounding",
+           ready && fabs(out - (127.5f - 10.75f)) < 1e-3f && rounded[len - 1] == 11);
+
+    // seeded with 100, then 104 weighed 1/4: 101, then 104 again: 101.75
+    Averager expo;
+    expo.set_mode(Averager::Exponential);
+    expo.set_count(4);
+    expo.add(vector<uint8_t>(len, 100).data(), len);
+    expo.add(vector<uint8_t>(len, 104).data(), len);
+    expo.add(vector<uint8_t>(len, 104).data(), len);
+    expo.to_float(&out, 0, 1, 1.0f);
+    expo.to_raw(rounded.data());
+    report("exponential average rounding",
+           fabs(out - (127.5f - 101.75f)) < 1e-3f && rounded[0] == 102);
+}
+
+// feed synthetic sine frames of mv peak and frequency until done
+static bool autoset_converges(double mv, double frequency, uint64_t vdiv, uint64_t rate)
+{
+    const vector<uint64_t> vdivs = {10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+    const vector<uint64_t> rates = {
+        10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000,
+        10000000, 20000000, 50000000, 100000000, 200000000, 500000000, 1000000000
+    };
+    const size_t len = 2048;
+    Autoset as(vdivs, rates, 1000000);
+    while (!as.done()) {
+        const vector<uint8_t> data = sine(len, frequency / as.samplerate(), mv, as.vdiv());
+        as.feed(data.data(), len);
+    }
+    return as.vdiv() == vdiv && as.samplerate() == rate && as.trigger_value() == 128;
+}
+
+static void check_autoset()
+{
+    report("autoset 600 mVpp 1 kHz sine", autoset_converges(300, 1000, 100, 500000));
+    report("autoset 2 Vpp 100 kHz sine", autoset_converges(1000, 100000, 500, 50000000));
+}
+
+int main()
+{
+    check_spectrum();
+    check_measurement();
+    check_mask_runs();
+    check_averager();
+    check_autoset();
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <atomic>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framepool.h"
+
+FramePool::FramePool(size_t count) :
+        _buffers(count),
+        _sizes(count, 0),
+        _next(0)
+{
+    assert(count > 0);
+}
+
+std::shared_ptr<uint8_t> FramePool::acquire(size_t size)
+{
+    for (size_t n = 0; n < _buffers.size(); n++) {
+        const size_t i = _next;
+        _next = (_next + 1) % _buffers.size();
+
+        // referenced by a queued frame or by a downstream block
+        if (_buffers[i] && _buffers[i].use_count() != 1)
+            continue;
+        // pairs with the release of the last downstream reference
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (_sizes[i] < size && !grow(i, size))
+            return std::shared_ptr<uint8_t>();
+        return _buffers[i];
+    }
+    return std::shared_ptr<uint8_t>();
+}
+
+void FramePool::reserve(size_t size)
+{
+    for (size_t i = 0; i < _buffers.size(); i++) {
+        if (_buffers[i] && _buffers[i].use_count() != 1)
+            continue;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sizes[i] < size && grow(i, size))
+            memset(_buffers[i].get(), 0, _sizes[i]);
+    }
+}
+
+bool FramePool::grow(size_t i, size_t size)
+{
+    size_t alloc = 4096;
+    while (alloc < size)
+        alloc <<= 1;
+    // aligned for the vector loads of the frame consumers
+    void *data = NULL;
+    if (posix_memalign(&data, 64, alloc) != 0)
+        return false;
+    _buffers[i].reset((uint8_t *)data, free);
+    _sizes[i] = alloc;
+    return true;
+}
+
+size_t FramePool::count() const
+{
+    return _buffers.size();
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _FRAMEPOOL_H_
+#define _FRAMEPOOL_H_
+
+#include <memory>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fixed set of frame buffers the sampling thread copies dso packets into.
+ *
+ * Buffers are handed out as shared pointers so a frame can be passed
+ * downstream by reference, a buffer is free again once every holder has
+ * dropped its reference. Handing out a buffer never allocates, a buffer
+ * is only reallocated when a larger frame size is requested.
+ */
+class FramePool
+{
+public:
+    static const size_t DefaultCount = 32;
+
+public:
+    explicit FramePool(size_t count = DefaultCount);
+
+    /**
+     * A free buffer of at least size bytes, or an empty pointer when all
+     * buffers are still referenced. Only one thread may acquire.
+     */
+    std::shared_ptr<uint8_t> acquire(size_t size);
+
+    /**
+     * Grow the free buffers to at least size bytes and touch their pages,
+     * so the first frames neither allocate nor fault. Called by the
+     * acquiring thread before it starts.
+     */
+    void reserve(size_t size);
+
+    size_t count() const;
+
+private:
+    bool grow(size_t i, size_t size);
+
+private:
+    std::vector<std::shared_ptr<uint8_t> > _buffers;
+    std::vector<size_t> _sizes;
+    size_t _next;
+};
+
+#endif  // _FRAMEPOOL_H_
@@ -0,0 +1,117 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <algorithm>
+#include <assert.h>
+
+#include "framesizer.h"
+
+FrameSizer::FrameSizer() :
+        _mode(Fixed),
+        _target_latency(0.01),
+        _min_size(DefaultMin),
+        _max_size(DefaultMax),
+        _held_frames(0)
+{
+}
+
+FrameSizer::mode FrameSizer::get_mode() const
+{
+    return _mode;
+}
+
+void FrameSizer::set_mode(mode m)
+{
+    _mode = m;
+    _held_frames = 0;
+}
+
+double FrameSizer::get_target_latency() const
+{
+    return _target_latency;
+}
+
+void FrameSizer::set_target_latency(double seconds)
+{
+    assert(seconds > 0);
+    _target_latency = seconds;
+    _held_frames = 0;
+}
+
+bool FrameSizer::set_bounds(uint64_t min_size, uint64_t max_size)
+{
+    assert(min_size > 0);
+    assert(min_size <= max_size);
+    uint64_t lo = 1;
+    while (lo < min_size && lo < (UINT64_C(1) << 63))
+        lo <<= 1;
+    uint64_t hi = UINT64_C(1) << 63;
+    while (hi > max_size)
+        hi >>= 1;
+    if (lo < min_size || lo > hi)
+        return false;
+    _min_size = lo;
+    _max_size = hi;
+    _held_frames = 0;
+    return true;
+}
+
+uint64_t FrameSizer::min_size() const
+{
+    return _min_size;
+}
+
+uint64_t FrameSizer::max_size() const
+{
+    return _max_size;
+}
+
+// nearest power of two within the bounds, which are powers of two
+uint64_t FrameSizer::clamp(uint64_t size) const
+{
+    uint64_t pow2 = 1;
+    while (pow2 < size && pow2 < (UINT64_C(1) << 62))
+        pow2 <<= 1;
+    if (pow2 > size && pow2 - size > size - pow2 / 2)
+        pow2 >>= 1;
+
+    if (pow2 < _min_size)
+        return _min_size;
+    if (pow2 > _max_size)
+        return _max_size;
+    return pow2;
+}
+
+uint64_t FrameSizer::update(uint64_t samplerate, uint64_t cur_size, uint64_t frame_len,
+                            unsigned int frames, double work_ns,
+                            size_t queue_depth, size_t out_elems)
+{
+    if (_mode == Fixed || frames == 0 || samplerate == 0 || frame_len == 0)
+        return cur_size;
+
+    _held_frames += frames;
+    if (_held_frames < HoldFrames)
+        return cur_size;
+
+    uint64_t size;
+    if (_mode == Latency)
+        size = (uint64_t)(samplerate * _target_latency);
+    else
+        size = out_elems;
+
+    // the load of the frames as received
+    const double frame_ns = frame_len * 1e9 / samplerate;
+    const double load = work_ns / frames / frame_ns;
+    if (queue_depth > 2 || load > 0.8) {
+        // the consumer falls behind, fewer and larger frames
+        size = std::max(size, frame_len * 2);
+    } else if (size < frame_len && (queue_depth > 0 || load > 0.4)) {
+        // only shrink when a smaller frame is sure to keep up
+        size = frame_len;
+    }
+
+    size = clamp(size);
+    if (size != cur_size)
+        _held_frames = 0;
+    return size;
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _FRAMESIZER_H_
+#define _FRAMESIZER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Picks SR_CONF_LIMIT_SAMPLES from what the capture path observes.
+ *
+ * Latency mode sizes a frame so that it takes the target latency to
+ * capture, throughput mode sizes it to fill one output buffer. Both grow
+ * the frame while the consumer falls behind (frames pile up in the queue
+ * or converting a frame takes most of its capture time), because the per
+ * frame overhead is then what limits the rate, and only shrink it while
+ * the consumer is mostly idle. Sizes are powers of two within the bounds,
+ * the bounds are rounded inwards to powers of two, and a new size is only
+ * suggested after HoldFrames frames were seen with the current one.
+ */
+class FrameSizer
+{
+public:
+    enum mode {
+        Fixed,
+        Latency,
+        Throughput
+    };
+
+    static const uint64_t DefaultMin = 1024;
+    static const uint64_t DefaultMax = 1024 * 1024;
+    static const unsigned int HoldFrames = 16;
+
+public:
+    FrameSizer();
+
+    mode get_mode() const;
+    void set_mode(mode m);
+
+    double get_target_latency() const;
+    void set_target_latency(double seconds);
+
+    /**
+     * Round the bounds inwards to powers of two.
+     * @return false, keeping the old bounds, without a power of two in them
+     */
+    bool set_bounds(uint64_t min_size, uint64_t max_size);
+    uint64_t min_size() const;
+    uint64_t max_size() const;
+
+    /**
+     * Account frames converted with the current size.
+     *
+     * @param samplerate current sample rate
+     * @param cur_size current frame size as requested
+     * @param frame_len samples per frame actually received, the driver may
+     * round the request
+     * @param frames number of frames completed since the last update
+     * @param work_ns time spent converting those frames
+     * @param queue_depth frames still waiting in the capture queue
+     * @param out_elems size of the output buffer in samples
+     * @return the frame size to use, equal to cur_size when unchanged
+     */
+    uint64_t update(uint64_t samplerate, uint64_t cur_size, uint64_t frame_len,
+                    unsigned int frames, double work_ns,
+                    size_t queue_depth, size_t out_elems);
+
+private:
+    uint64_t clamp(uint64_t size) const;
+
+private:
+    mode _mode;
+    double _target_latency;
+    uint64_t _min_size;
+    uint64_t _max_size;
+    unsigned int _held_frames;
+};
+
+#endif  // _FRAMESIZER_H_
@@ -0,0 +1,297 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#include "logbridge.h"
+
+namespace LogBridge {
+
+std::atomic<int> _level(2);
+
+namespace {
+
+const size_t SiteSlots = 512;
+const size_t SiteProbes = 8;
+
+struct message {
+    int level;
+    const char *source;
+    uint32_t suppressed;
+    char text[MessageSize];
+};
+
+struct site_state {
+    std::atomic<const void*> key;
+    std::atomic<int64_t> window;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> suppressed;
+};
+
+// bounded multi-producer queue, one sequence number per cell
+struct cell {
+    std::atomic<size_t> seq;
+    message msg;
+};
+
+struct bridge {
+    cell cells[QueueSlots];
+    std::atomic<size_t> enqueue_pos;
+    std::atomic<size_t> dequeue_pos;
+    std::atomic<uint64_t> dropped;
+
+    site_state sites[SiteSlots];
+    std::atomic<unsigned int> rate_limit;
+
+    std::mutex sink_mutex;
+    sink out;
+
+    std::mutex thread_mutex;
+    std::thread worker;
+    std::atomic<bool> running;
+    std::atomic<bool> stopped;
+
+    bridge() :
+        enqueue_pos(0),
+        dequeue_pos(0),
+        dropped(0),
+        rate_limit(DefaultRateLimit),
+        running(false),
+        stopped(false)
+    {
+        for (size_t i = 0; i < QueueSlots; i++)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        for (size_t i = 0; i < SiteSlots; i++) {
+            sites[i].key.store(NULL, std::memory_order_relaxed);
+            sites[i].window.store(0, std::memory_order_relaxed);
+            sites[i].count.store(0, std::memory_order_relaxed);
+            sites[i].suppressed.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// never destroyed, capture threads may still log during static destruction
+bridge &instance()
+{
+    static bridge *b = new bridge();
+    return *b;
+}
+
+void write_stderr(int level, const char *source, const char *text)
+{
+    static const char *names[] = {"NONE", "ERROR", "WARN", "INFO", "DEBUG", "SPEW"};
+    fprintf(stderr, "[%s] %s: %s\n", names[level < 0 ? 0 : level > 5 ? 5 : level], source, text);
+}
+
+const char *basename_of(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+int64_t now_s()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// true if the site may log now, suppressed is what it lost before
+bool admit(bridge &b, const void *site, uint32_t &suppressed)
+{
+    suppressed = 0;
+    const unsigned int limit = b.rate_limit.load(std::memory_order_relaxed);
+    if (limit == 0)
+        return true;
+
+    size_t slot = (size_t)((uintptr_t(site) >> 3) * 2654435761u) % SiteSlots;
+    site_state *s = NULL;
+    for (size_t i = 0; i < SiteProbes; i++, slot = (slot + 1) % SiteSlots) {
+        const void *key = b.sites[slot].key.load(std::memory_order_acquire);
+        if (key == NULL && b.sites[slot].key.compare_exchange_strong(key, site))
+            key = site;
+        if (key == site) {
+            s = &b.sites[slot];
+            break;
+        }
+    }
+    // too many sites to track, let it through
+    if (!s)
+        return true;
+
+    const int64_t now = now_s();
+    int64_t window = s->window.load(std::memory_order_relaxed);
+    if (window != now && s->window.compare_exchange_strong(window, now))
+        s->count.store(0, std::memory_order_relaxed);
+
+    if (s->count.fetch_add(1, std::memory_order_relaxed) < limit) {
+        suppressed = s->suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+    s->suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void deliver(bridge &b, const message &msg)
+{
+    char text[MessageSize + 48];
+    const char *out = msg.text;
+    if (msg.suppressed) {
+        snprintf(text, sizeof(text), "%s (%u similar messages suppressed)", msg.text, msg.suppressed);
+        out = text;
+    }
+
+    std::lock_guard<std::mutex> lock(b.sink_mutex);
+    if (b.out)
+        b.out(msg.level, msg.source, out);
+    else
+        write_stderr(msg.level, msg.source, out);
+}
+
+bool dequeue(bridge &b)
+{
+    size_t pos = b.dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        cell &c = b.cells[pos % QueueSlots];
+        const size_t seq = c.seq.load(std::memory_order_acquire);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (b.dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                deliver(b, c.msg);
+                c.seq.store(pos + QueueSlots, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = b.dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void worker_proc(bridge *b)
+{
+    while (b->running.load(std::memory_order_acquire)) {
+        if (!dequeue(*b))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    while (dequeue(*b)) {
+    }
+}
+
+void start(bridge &b)
+{
+    std::lock_guard<std::mutex> lock(b.thread_mutex);
+    if (b.running.load(std::memory_order_relaxed) || b.stopped.load(std::memory_order_relaxed))
+        return;
+    b.running.store(true, std::memory_order_release);
+    b.worker = std::thread(worker_proc, &b);
+}
+
+// drains the queue when the module is unloaded
+struct LogReaper {
+    ~LogReaper() { stop(); }
+} reaper;
+
+}
+
+void set_level(int level)
+{
+    _level.store(level, std::memory_order_relaxed);
+}
+
+void set_sink(const sink &s)
+{
+    bridge &b = instance();
+    std::lock_guard<std::mutex> lock(b.sink_mutex);
+    b.out = s;
+}
+
+void set_rate_limit(unsigned int per_second)
+{
+    instance().rate_limit.store(per_second, std::memory_order_relaxed);
+}
+
+void log(int level, const void *site, const char *source, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vlog(level, site, source, format, args);
+    va_end(args);
+}
+
+void vlog(int level, const void *site, const char *source, const char *format, va_list args)
+{
+    bridge &b = instance();
+    uint32_t suppressed;
+    if (!admit(b, site, suppressed))
+        return;
+
+    source = basename_of(source);
+    if (b.stopped.load(std::memory_order_acquire)) {
+        char text[MessageSize];
+        vsnprintf(text, sizeof(text), format, args);
+        write_stderr(level, source, text);
+        return;
+    }
+    if (!b.running.load(std::memory_order_acquire))
+        start(b);
+
+    size_t pos = b.enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        cell &c = b.cells[pos % QueueSlots];
+        const size_t seq = c.seq.load(std::memory_order_acquire);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (b.enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                // format straight into the slot, nothing is allocated
+                c.msg.level = level;
+                c.msg.source = source;
+                c.msg.suppressed = suppressed;
+                vsnprintf(c.msg.text, sizeof(c.msg.text), format, args);
+                c.seq.store(pos + 1, std::memory_order_release);
+                return;
+            }
+        } else if (diff < 0) {
+            b.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = b.enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+int sr_log_handler(void *cb_data, int loglevel, const char *format, va_list args)
+{
+    (void) cb_data;
+    if (loglevel > level())
+        return 0;
+    // the format string is the call site in libsigrok
+    vlog(loglevel, format, "libsigrok", format, args);
+    return 0;
+}
+
+uint64_t dropped()
+{
+    return instance().dropped.load(std::memory_order_relaxed);
+}
+
+void stop()
+{
+    bridge &b = instance();
+    {
+        // the installed sink may live in a module that is going away
+        std::lock_guard<std::mutex> lock(b.sink_mutex);
+        b.out = sink();
+    }
+
+    std::lock_guard<std::mutex> lock(b.thread_mutex);
+    b.stopped.store(true, std::memory_order_release);
+    if (b.running.exchange(false, std::memory_order_acq_rel))
+        b.worker.join();
+}
+
+}
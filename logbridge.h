@@ -0,0 +1,78 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _LOGBRIDGE_H_
+#define _LOGBRIDGE_H_
+
+#include <atomic>
+#include <functional>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Asynchronous log path for libsigrok, the session and the block.
+ *
+ * Messages are formatted into a slot of a lock-free queue by the calling
+ * thread, a background thread hands them to the sink. A capture thread
+ * never waits on the console or the logger. Every call site is limited to
+ * a number of messages per second, the surplus is counted and reported
+ * with the next message that gets through. When the queue is full
+ * messages are dropped, not waited for.
+ *
+ * The default sink writes to stderr, the block installs one that forwards
+ * to the Poco logger. Levels are the SR_LOG_* levels of libsigrok.
+ */
+namespace LogBridge {
+
+static const size_t QueueSlots = 1024;
+static const size_t MessageSize = 256;
+static const unsigned int DefaultRateLimit = 20;
+
+typedef std::function<void(int level, const char *source, const char *text)> sink;
+
+extern std::atomic<int> _level;
+
+inline int level()
+{
+    return _level.load(std::memory_order_relaxed);
+}
+
+void set_level(int level);
+
+// an empty sink restores the stderr sink
+void set_sink(const sink &s);
+
+// messages per second and call site, 0 for no limit
+void set_rate_limit(unsigned int per_second);
+
+/**
+ * Queue a printf style message. site identifies the call site for the
+ * rate limit, any address unique to it.
+ */
+void log(int level, const void *site, const char *source, const char *format, ...)
+        __attribute__((format(printf, 4, 5)));
+void vlog(int level, const void *site, const char *source, const char *format, va_list args);
+
+// for sr_log_callback_set()
+int sr_log_handler(void *cb_data, int loglevel, const char *format, va_list args);
+
+// messages lost because the queue was full
+uint64_t dropped();
+
+/**
+ * Deliver what is queued and stop the background thread, later messages
+ * are written to stderr synchronously.
+ */
+void stop();
+
+}
+
+#define DS_LOG(lvl, ...) do { \
+        if ((lvl) <= LogBridge::level()) { \
+            static const char _log_site = 0; \
+            LogBridge::log((lvl), &_log_site, __FILE__, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif  // _LOGBRIDGE_H_
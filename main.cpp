@@ -5,13 +5,98 @@
 #include "sigsession.h"
 #include "devinst.h"
 #include "device.h"
+#include "allocaudit.h"
+#ifdef DSCOPE_SNAPSHOT_CHECK
+#include <string.h>
+#include <vector>
+#include "dsosnapshot.h"
+#endif
 using namespace std;
 
+#ifdef DSCOPE_ALLOC_AUDIT
+// Capture frames until the pools and queues reached their high-water
+// mark, then fail if the capture path still allocates per frame.
+static int audit_allocations(BlockingQueue<DsoFrame> &dso_queue)
+{
+    const int warmup_frames = 200;
+    const int audit_frames = 1000;
+
+    for (int i = 0; i < warmup_frames; i++)
+        dso_queue.take();
+
+    AllocAudit::reset();
+    for (int i = 0; i < audit_frames; i++) {
+        ALLOC_AUDIT_SCOPE();
+        dso_queue.take();
+    }
+    const uint64_t allocs = AllocAudit::count();
+
+    cout << "allocations after warm-up: " << allocs << " in "
+         << audit_frames << " frames ("
+         << (double)allocs / audit_frames << " per frame)" << endl;
+    return allocs == 0 ? 0 : 1;
+}
+#endif
+
+#ifdef DSCOPE_SNAPSHOT_CHECK
+// Fill a snapshot with a known frame under every allocation policy, small
+// and above a huge page, and read it back through a view.
+static int check_snapshot_storage()
+{
+    const Snapshot::alloc_policy policies[] = {
+        Snapshot::AlignedAlloc, Snapshot::HugePageAlloc, Snapshot::AutoAlloc
+    };
+    const char *names[] = {"aligned", "hugepage", "auto"};
+    const uint64_t sizes[] = {4096, 4 * Snapshot::HugePageSize};
+    std::map<int, bool> ch_enable;
+    ch_enable[0] = true;
+    int failed = 0;
+
+    for (int p = 0; p < 3; p++) {
+        for (uint64_t size : sizes) {
+            std::vector<uint8_t> samples(size);
+            for (uint64_t i = 0; i < size; i++)
+                samples[i] = (uint8_t)(i * 7);
+            sr_datafeed_dso dso;
+            memset(&dso, 0, sizeof(dso));
+            dso.num_samples = size;
+            dso.data = samples.data();
+
+            DsoSnapshot snapshot;
+            snapshot.set_alloc_policy(policies[p]);
+            snapshot.first_payload(dso, size, ch_enable, false);
+
+            const bool mapped = policies[p] == Snapshot::HugePageAlloc ||
+                    (policies[p] == Snapshot::AutoAlloc && size >= Snapshot::HugePageSize);
+            Snapshot::read_guard guard(snapshot);
+            DsoSnapshot::sample_view view;
+            bool ok = !snapshot.memory_failed() &&
+                      snapshot.memory_mapped() == mapped &&
+                      (uintptr_t)snapshot.get_data() % Snapshot::DataAlignment == 0 &&
+                      snapshot.get_view(0, size, view);
+            if (ok) {
+                ok = std::equal(view.begin(0), view.end(0), samples.begin()) &&
+                     snapshot.view_valid(view);
+            }
+            cout << "snapshot storage " << names[p] << " " << size << " samples: "
+                 << (ok ? "ok" : "FAILED") << endl;
+            if (!ok)
+                failed++;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     int ret = 0;
     struct sr_context *sr_ctx = NULL;
 
+#ifdef DSCOPE_SNAPSHOT_CHECK
+    return check_snapshot_storage();
+#endif
+
     sr_log_loglevel_set(SR_LOG_SPEW);
 
     // Initialise libsigrok
@@ -20,7 +105,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    BlockingQueue<sr_datafeed_dso> dso_queue;
+    BlockingQueue<DsoFrame> dso_queue;
     DeviceManager _device_manager(sr_ctx);
     SigSession _session(_device_manager, dso_queue);
 
@@ -85,7 +170,11 @@ int main(int argc, char *argv[])
         // xdiv = current div of voltage (eg. 10mv)
         //(127.5-v) * 10 * vdiv / (1 << 8)
     }*/
+#ifdef DSCOPE_ALLOC_AUDIT
+    ret = audit_allocations(dso_queue);
+#else
     getchar();
+#endif
     //GMainLoop *main_loop = g_main_loop_new(NULL, FALSE);
     //g_main_loop_run(main_loop);
     _session.stop_capture();
@@ -0,0 +1,142 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "masktest.h"
+
+MaskTest::MaskTest() :
+        _len(0),
+        _vdiv(0),
+        _tested(0),
+        _failed(0),
+        _violations(0)
+{
+}
+
+void MaskTest::set_mask(const std::vector<double> &upper, const std::vector<double> &lower)
+{
+    assert(!upper.empty() && upper.size() == lower.size());
+    _upper = upper;
+    _lower = lower;
+    _len = 0;
+}
+
+bool MaskTest::has_mask() const
+{
+    return !_upper.empty();
+}
+
+// mv = (127.5 - raw) * vdiv / 25.6, the upper mask bounds the raw
+// sample from below and the lower mask from above
+void MaskTest::quantize(size_t len, uint64_t vdiv)
+{
+    const double raw_per_mv = 25.6 / vdiv;
+    _min.resize(len);
+    _max.resize(len);
+    for (size_t i = 0; i < len; i++) {
+        const size_t m = i * _upper.size() / len;
+        const double lo = ceil(127.5 - _upper[m] * raw_per_mv);
+        const double hi = floor(127.5 - _lower[m] * raw_per_mv);
+        _min[i] = (uint8_t)std::min(255.0, std::max(0.0, lo));
+        _max[i] = (uint8_t)std::min(255.0, std::max(0.0, hi));
+    }
+    _len = len;
+    _vdiv = vdiv;
+}
+
+bool MaskTest::check(const uint8_t *data, size_t len, uint64_t vdiv, result &res)
+{
+    res.violations = 0;
+    res.runs = 0;
+    if (!has_mask() || len == 0 || vdiv == 0)
+        return true;
+    if (len != _len || vdiv != _vdiv)
+        quantize(len, vdiv);
+
+    const uint8_t *lo = _min.data();
+    const uint8_t *hi = _max.data();
+    bool in_run = false;
+    bool recording = false;
+
+    // one bit per sample outside the mask, walked only when set
+    auto account = [&](unsigned int bits, size_t base, unsigned int width) {
+        for (unsigned int b = 0; b < width; b++) {
+            if (!(bits & (1u << b))) {
+                in_run = false;
+                continue;
+            }
+            res.violations++;
+            if (!in_run) {
+                recording = res.runs < MaxRuns;
+                if (recording) {
+                    res.run_start[res.runs] = base + b;
+                    res.run_length[res.runs] = 0;
+                    res.runs++;
+                }
+            }
+            if (recording)
+                res.run_length[res.runs - 1]++;
+            in_run = true;
+        }
+    };
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+        const __m128i l = _mm_loadu_si128((const __m128i *)(lo + i));
+        const __m128i h = _mm_loadu_si128((const __m128i *)(hi + i));
+        // x in [l, h] when max(x, l) == x and min(x, h) == x
+        const __m128i in = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, l), x),
+                                         _mm_cmpeq_epi8(_mm_min_epu8(x, h), x));
+        const unsigned int bits = ~(unsigned int)_mm_movemask_epi8(in) & 0xffff;
+        if (bits)
+            account(bits, i, 16);
+        else
+            in_run = false;
+    }
+#endif
+    for (; i < len; i++) {
+        const unsigned int bad = (data[i] < lo[i] || data[i] > hi[i]) ? 1 : 0;
+        if (bad)
+            account(bad, i, 1);
+        else
+            in_run = false;
+    }
+
+    _tested++;
+    _violations += res.violations;
+    if (res.violations == 0)
+        return true;
+    _failed++;
+    return false;
+}
+
+uint64_t MaskTest::get_tested() const
+{
+    return _tested;
+}
+
+uint64_t MaskTest::get_failed() const
+{
+    return _failed;
+}
+
+uint64_t MaskTest::get_violations() const
+{
+    return _violations;
+}
+
+void MaskTest::reset_counters()
+{
+    _tested = 0;
+    _failed = 0;
+    _violations = 0;
+}
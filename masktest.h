@@ -0,0 +1,72 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _MASKTEST_H_
+#define _MASKTEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Pass/fail test of raw frames against an upper and a lower mask.
+ *
+ * The masks are given in mv per point and stretched over the frame. They
+ * are quantized once per frame length and vdiv into the range of raw
+ * samples that lie within them, so a frame is tested with two unsigned
+ * byte compares per sample and no conversion. Bounds beyond the ADC range
+ * clip to it.
+ */
+class MaskTest
+{
+public:
+    // violation runs reported per frame, the count covers all of them
+    static const unsigned int MaxRuns = 16;
+
+    struct result {
+        size_t violations;          // samples outside the mask
+        unsigned int runs;          // reported runs of violating samples
+        size_t run_start[MaxRuns];
+        size_t run_length[MaxRuns];
+    };
+
+public:
+    MaskTest();
+
+    /**
+     * Set the mask in mv, upper and lower have the same non-zero length
+     * and upper[i] >= lower[i].
+     */
+    void set_mask(const std::vector<double> &upper, const std::vector<double> &lower);
+    bool has_mask() const;
+
+    /**
+     * Test a frame captured with vdiv.
+     * @return true when every sample lies within the mask
+     */
+    bool check(const uint8_t *data, size_t len, uint64_t vdiv, result &res);
+
+    uint64_t get_tested() const;
+    uint64_t get_failed() const;
+    uint64_t get_violations() const;
+    void reset_counters();
+
+private:
+    void quantize(size_t len, uint64_t vdiv);
+
+private:
+    std::vector<double> _upper;
+    std::vector<double> _lower;
+
+    // raw samples within the mask are in [_min[i], _max[i]]
+    std::vector<uint8_t> _min;
+    std::vector<uint8_t> _max;
+    size_t _len;
+    uint64_t _vdiv;
+
+    uint64_t _tested;
+    uint64_t _failed;
+    uint64_t _violations;
+};
+
+#endif  // _MASKTEST_H_
@@ -0,0 +1,275 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "measurement.h"
+
+// top and base are histogram modes only when they hold this share of samples
+static const double DominantLevel = 0.05;
+
+// edges need this many levels between base and top
+static const double MinSwing = 4.0;
+
+// The measurements are done on levels, 255 - raw, which rise with the
+// voltage: mv = (level - 127.5) * vdiv / 25.6
+bool Measurement::measure(const uint8_t *data, size_t len,
+                          uint64_t samplerate, uint64_t vdiv, result &res)
+{
+    if (len == 0 || vdiv == 0)
+        return false;
+
+    stats st;
+    statistics(data, len, st);
+
+    // four partial histograms, consecutive equal samples do not wait on
+    // the increment before
+    uint32_t hist[4][256];
+    memset(hist, 0, sizeof(hist));
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        hist[0][data[i]]++;
+        hist[1][data[i + 1]]++;
+        hist[2][data[i + 2]]++;
+        hist[3][data[i + 3]]++;
+    }
+    for (; i < len; i++)
+        hist[0][data[i]]++;
+    auto count = [&hist](int level) {
+        const int raw = 255 - level;
+        return hist[0][raw] + hist[1][raw] + hist[2][raw] + hist[3][raw];
+    };
+
+    const int lmin = 255 - st.max;
+    const int lmax = 255 - st.min;
+    const double mid = (lmin + lmax) / 2.0;
+    int top = lmax;
+    int base = lmin;
+    uint32_t top_count = 0;
+    uint32_t base_count = 0;
+    for (int l = lmin; l <= lmax; l++) {
+        const uint32_t c = count(l);
+        if (l > mid && c > top_count) {
+            top = l;
+            top_count = c;
+        } else if (l <= mid && c > base_count) {
+            base = l;
+            base_count = c;
+        }
+    }
+    if (top_count < DominantLevel * len)
+        top = lmax;
+    if (base_count < DominantLevel * len)
+        base = lmin;
+
+    const double scale = vdiv / 25.6;
+    const double swing = top - base;
+    res.vmax = (lmax - 127.5) * scale;
+    res.vmin = (lmin - 127.5) * scale;
+    res.vtop = (top - 127.5) * scale;
+    res.vbase = (base - 127.5) * scale;
+    res.amplitude = swing * scale;
+
+    const double mean = double(st.sum) / len;
+    const double mean_sq = double(st.sum_sq) / len - 2 * 127.5 * mean + 127.5 * 127.5;
+    res.vmean = (127.5 - mean) * scale;
+    res.vrms = sqrt(std::max(0.0, mean_sq)) * scale;
+
+    res.overshoot = swing > 0 ? (lmax - top) / swing * 100.0 : NAN;
+    res.preshoot = swing > 0 ? (base - lmin) / swing * 100.0 : NAN;
+
+    res.frequency = NAN;
+    res.period = NAN;
+    res.duty = NAN;
+    res.rise_time = NAN;
+    res.fall_time = NAN;
+    res.rising_edges = 0;
+    res.falling_edges = 0;
+    if (swing >= MinSwing && samplerate > 0) {
+        // in samples, converted below
+        find_edges(data, len, base, top, res);
+        res.period /= samplerate;
+        res.frequency = 1.0 / res.period;
+        res.rise_time /= samplerate;
+        res.fall_time /= samplerate;
+    }
+    return true;
+}
+
+void Measurement::statistics(const uint8_t *data, size_t len, stats &st)
+{
+    uint8_t vmin = 0xff;
+    uint8_t vmax = 0;
+    uint64_t sum = 0;
+    uint64_t sum_sq = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i mn = _mm_set1_epi8((char)0xff);
+    __m128i mx = zero;
+    __m128i s = zero;
+    __m128i sq = zero;
+    __m128i sq64 = zero;
+    unsigned int n = 0;
+    // the 32 bit squares are moved to 64 bit before 4096 * 2 * 2 * 255^2
+    // would overflow them
+    auto flush = [&]() {
+        sq64 = _mm_add_epi64(sq64, _mm_unpacklo_epi32(sq, zero));
+        sq64 = _mm_add_epi64(sq64, _mm_unpackhi_epi32(sq, zero));
+        sq = zero;
+        n = 0;
+    };
+    for (; i + 16 <= len; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+        mn = _mm_min_epu8(mn, x);
+        mx = _mm_max_epu8(mx, x);
+        s = _mm_add_epi64(s, _mm_sad_epu8(x, zero));
+        const __m128i lo = _mm_unpacklo_epi8(x, zero);
+        const __m128i hi = _mm_unpackhi_epi8(x, zero);
+        sq = _mm_add_epi32(sq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        if (++n == 4096)
+            flush();
+    }
+    flush();
+
+    uint8_t mins[16], maxs[16];
+    uint64_t sums[2], sqs[2];
+    _mm_storeu_si128((__m128i *)mins, mn);
+    _mm_storeu_si128((__m128i *)maxs, mx);
+    _mm_storeu_si128((__m128i *)sums, s);
+    _mm_storeu_si128((__m128i *)sqs, sq64);
+    for (int k = 0; k < 16; k++) {
+        vmin = std::min(vmin, mins[k]);
+        vmax = std::max(vmax, maxs[k]);
+    }
+    sum = sums[0] + sums[1];
+    sum_sq = sqs[0] + sqs[1];
+#endif
+    for (; i < len; i++) {
+        vmin = std::min(vmin, data[i]);
+        vmax = std::max(vmax, data[i]);
+        sum += data[i];
+        sum_sq += (uint32_t)data[i] * data[i];
+    }
+    st.min = vmin;
+    st.max = vmax;
+    st.sum = sum;
+    st.sum_sq = sum_sq;
+}
+
+// An edge is where the level leaves the 10%..90% band to the other side
+// than it entered, which rejects noise below 80% of the amplitude. The
+// masks of samples above 90% and below 10% are built 16 samples at a time,
+// only their set bits are walked.
+void Measurement::find_edges(const uint8_t *data, size_t len,
+                             double base, double top, result &res)
+{
+    const double l10 = base + 0.1 * (top - base);
+    const double l50 = base + 0.5 * (top - base);
+    const double l90 = base + 0.9 * (top - base);
+    const int hi_th = (int)floor(l90);  // high above
+    const int lo_th = (int)ceil(l10);   // low below
+
+    auto level = [data](size_t j) { return 255.0 - data[j]; };
+    // position where the level crosses th between samples j and j + 1
+    auto cross = [&](size_t j, double th) {
+        const double a = level(j);
+        return j + (th - a) / (level(j + 1) - a);
+    };
+
+    int state = 0;  // -1 low, 1 high, 0 not known yet
+    unsigned int rises = 0, falls = 0, highs = 0;
+    double first_rise = 0, last_rise = 0, first_fall = 0, last_fall = 0;
+    double rise_sum = 0, fall_sum = 0, high_sum = 0;
+
+    // the walks back end at the latest where the other state was entered
+    auto on_rise = [&](size_t k) {
+        size_t j = k - 1;
+        const double t90 = cross(j, l90);
+        while (level(j) > l50) j--;
+        const double t50 = cross(j, l50);
+        while (level(j) > l10) j--;
+        const double t10 = cross(j, l10);
+        rise_sum += t90 - t10;
+        if (rises++ == 0)
+            first_rise = t50;
+        last_rise = t50;
+    };
+    auto on_fall = [&](size_t k) {
+        size_t j = k - 1;
+        const double t10 = cross(j, l10);
+        while (level(j) < l50) j--;
+        const double t50 = cross(j, l50);
+        while (level(j) < l90) j--;
+        const double t90 = cross(j, l90);
+        fall_sum += t10 - t90;
+        if (falls++ == 0)
+            first_fall = t50;
+        last_fall = t50;
+        if (rises > 0) {
+            high_sum += t50 - last_rise;
+            highs++;
+        }
+    };
+    auto walk = [&](uint32_t hi_bits, uint32_t lo_bits, size_t first, unsigned int width) {
+        unsigned int pos = 0;
+        while (pos < width) {
+            uint32_t bits;
+            if (state == 1) bits = lo_bits >> pos;
+            else if (state == -1) bits = hi_bits >> pos;
+            else bits = (hi_bits | lo_bits) >> pos;
+            if (bits == 0)
+                break;
+            const unsigned int b = pos + __builtin_ctz(bits);
+            const size_t k = first + b;
+            if (state == 1) {
+                on_fall(k);
+                state = -1;
+            } else if (state == -1) {
+                on_rise(k);
+                state = 1;
+            } else {
+                state = (hi_bits >> b) & 1 ? 1 : -1;
+            }
+            pos = b + 1;
+        }
+    };
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    // raw ^ 0x7f is level - 128 as a signed byte
+    const __m128i flip = _mm_set1_epi8(0x7f);
+    const __m128i hi_v = _mm_set1_epi8((char)(hi_th - 128));
+    const __m128i lo_v = _mm_set1_epi8((char)(lo_th - 128));
+    for (; i + 16 <= len; i += 16) {
+        const __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i)), flip);
+        const uint32_t hi_bits = _mm_movemask_epi8(_mm_cmpgt_epi8(s, hi_v));
+        const uint32_t lo_bits = _mm_movemask_epi8(_mm_cmplt_epi8(s, lo_v));
+        if (hi_bits | lo_bits)
+            walk(hi_bits, lo_bits, i, 16);
+    }
+#endif
+    for (; i < len; i++) {
+        const int l = 255 - data[i];
+        walk(l > hi_th, l < lo_th, i, 1);
+    }
+
+    res.rising_edges = rises;
+    res.falling_edges = falls;
+    if (rises >= 2)
+        res.period = (last_rise - first_rise) / (rises - 1);
+    else if (falls >= 2)
+        res.period = (last_fall - first_fall) / (falls - 1);
+    if (rises > 0)
+        res.rise_time = rise_sum / rises;
+    if (falls > 0)
+        res.fall_time = fall_sum / falls;
+    if (highs > 0 && !isnan(res.period))
+        res.duty = high_sum / highs / res.period * 100.0;
+}
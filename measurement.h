@@ -0,0 +1,69 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _MEASUREMENT_H_
+#define _MEASUREMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Automatic measurements of one raw frame, without converting it.
+ *
+ * Levels are measured from the histogram: top and base are the most
+ * common levels of the upper and lower half, or the extremes when no
+ * level dominates (sine, triangle). Edges are found with the 10% and 90%
+ * levels as hysteresis, the 10%, 50% and 90% crossings of an edge are
+ * interpolated between samples. The timing values are NaN when the frame
+ * holds too few edges, period and frequency need two rising (or falling)
+ * edges, the duty cycle a complete high phase.
+ */
+class Measurement
+{
+public:
+    struct result {
+        // mv
+        double vmax;
+        double vmin;
+        double vtop;
+        double vbase;
+        double amplitude;   // top - base
+        double vmean;
+        double vrms;        // about 0 mv
+
+        // percent of the amplitude
+        double overshoot;   // max above top
+        double preshoot;    // min below base
+
+        double frequency;   // Hz
+        double period;      // s
+        double duty;        // percent of the period
+        double rise_time;   // s, 10% to 90%, mean over the rising edges
+        double fall_time;   // s, 90% to 10%
+
+        unsigned int rising_edges;
+        unsigned int falling_edges;
+    };
+
+public:
+    /**
+     * Measure len raw samples captured with samplerate and vdiv.
+     * @return false when there is nothing to measure
+     */
+    static bool measure(const uint8_t *data, size_t len,
+                        uint64_t samplerate, uint64_t vdiv, result &res);
+
+private:
+    struct stats {
+        uint8_t min;
+        uint8_t max;
+        uint64_t sum;
+        uint64_t sum_sq;
+    };
+
+    static void statistics(const uint8_t *data, size_t len, stats &st);
+    static void find_edges(const uint8_t *data, size_t len,
+                           double base, double top, result &res);
+};
+
+#endif  // _MEASUREMENT_H_
@@ -0,0 +1,40 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include "metrics.h"
+
+using json = nlohmann::json;
+
+static const char *counter_names[Metrics::CounterCount] = {
+    "framesReceived",
+    "bytesReceived",
+    "framesProduced",
+    "elementsProduced",
+    "discontinuities",
+    "convertNs",
+    "convertSamples"
+};
+
+Metrics::Metrics()
+{
+    reset();
+}
+
+void Metrics::reset()
+{
+    for (int i = 0; i < CounterCount; i++)
+        _values[i].store(0, std::memory_order_relaxed);
+}
+
+const char *Metrics::name(counter c)
+{
+    return counter_names[c];
+}
+
+json Metrics::to_json() const
+{
+    json j;
+    for (int i = 0; i < CounterCount; i++)
+        j[counter_names[i]] = get(counter(i));
+    return j;
+}
@@ -0,0 +1,54 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <json.hpp>
+
+/**
+ * Runtime counters of one block instance.
+ * work() updates them without locks, the probes read them from any
+ * thread. Counters only grow until reset().
+ */
+class Metrics
+{
+public:
+    enum counter {
+        FramesReceived,
+        BytesReceived,
+        FramesProduced,
+        ElementsProduced,
+        Discontinuities,
+        ConvertNs,
+        ConvertSamples,
+        CounterCount
+    };
+
+public:
+    Metrics();
+
+    void add(counter c, uint64_t n = 1)
+    {
+        _values[c].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t get(counter c) const
+    {
+        return _values[c].load(std::memory_order_relaxed);
+    }
+
+    void reset();
+
+    static const char *name(counter c);
+
+    // every counter by name
+    nlohmann::json to_json() const;
+
+private:
+    std::atomic<uint64_t> _values[CounterCount];
+};
+
+#endif  // _METRICS_H_
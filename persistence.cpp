@@ -0,0 +1,237 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "persistence.h"
+#include "tracer.h"
+
+PersistenceMap::PersistenceMap() :
+        _next(0),
+        _req_columns(DefaultColumns),
+        _generation(0),
+        _skipped(0),
+        _columns(0),
+        _grid_generation(0),
+        _decay(0.9)
+{
+}
+
+PersistenceMap::~PersistenceMap()
+{
+    stop();
+}
+
+void PersistenceMap::start(unsigned int workers)
+{
+    assert(workers > 0 && workers <= MaxWorkers);
+    stop();
+    for (unsigned int i = 0; i < workers; i++) {
+        std::unique_ptr<worker> w(new worker());
+        w->column_len = 0;
+        w->columns = 0;
+        w->generation = _generation;
+        w->frames = 0;
+        w->thread.reset(new boost::thread(&PersistenceMap::worker_proc, this, w.get()));
+        _workers.push_back(std::move(w));
+    }
+    for (size_t i = 0; i < workers * MaxPending; i++) {
+        _buffers.emplace_back(new std::vector<uint8_t>());
+        _free.put(_buffers.back().get());
+    }
+    _next = 0;
+}
+
+void PersistenceMap::stop()
+{
+    for (auto &w : _workers) {
+        job j = job();
+        j.stop = true;
+        w->queue.put(j);
+    }
+    for (auto &w : _workers)
+        w->thread->join();
+    _workers.clear();
+    _free.clear();
+    _buffers.clear();
+}
+
+bool PersistenceMap::running() const
+{
+    return !_workers.empty();
+}
+
+unsigned int PersistenceMap::get_columns() const
+{
+    return _req_columns;
+}
+
+void PersistenceMap::set_columns(unsigned int columns)
+{
+    assert(columns > 0 && columns <= MaxColumns);
+    _req_columns = columns;
+    clear();
+}
+
+double PersistenceMap::get_decay() const
+{
+    return _decay;
+}
+
+void PersistenceMap::set_decay(double decay)
+{
+    assert(decay >= 0.0 && decay <= 1.0);
+    _decay = decay;
+}
+
+void PersistenceMap::clear()
+{
+    // the workers reset their grid on the first frame of the new generation
+    _generation++;
+}
+
+bool PersistenceMap::add(const DsoFrame &frame)
+{
+    if (_workers.empty())
+        return false;
+
+    // the next worker with room, they all fall behind when none has
+    std::vector<uint8_t> *samples;
+    for (size_t i = 0; i < _workers.size() && _free.try_take(samples); i++) {
+        worker &w = *_workers[_next];
+        _next = (_next + 1) % _workers.size();
+        if (w.queue.size() < MaxPending) {
+            const uint8_t *data = (const uint8_t *)frame.dso.data;
+            samples->assign(data, data + frame.dso.num_samples);
+            job j;
+            j.samples = samples;
+            j.generation = _generation;
+            j.columns = _req_columns;
+            j.stop = false;
+            w.queue.put(std::move(j));
+            return true;
+        }
+        _free.put(samples);
+    }
+    _skipped++;
+    return false;
+}
+
+uint64_t PersistenceMap::merge()
+{
+    if (_grid_generation != _generation) {
+        std::fill(_grid.begin(), _grid.end(), 0);
+        _grid_generation = _generation;
+    }
+
+    // cells keep decay of their hits, in 16 bit fixed point
+    const uint64_t keep = (uint64_t)(_decay * 65536.0 + 0.5);
+    if (keep < 65536) {
+        for (size_t i = 0; i < _grid.size(); i++)
+            _grid[i] = (uint32_t)((_grid[i] * keep) >> 16);
+    }
+
+    uint64_t frames = 0;
+    for (auto &wp : _workers) {
+        worker &w = *wp;
+        boost::lock_guard<boost::mutex> lock(w.mutex);
+        if (w.generation != _generation || w.frames == 0)
+            continue;
+        if (w.columns != _columns) {
+            _grid.assign((size_t)w.columns * Rows, 0);
+            _columns = w.columns;
+        }
+        // saturating, with no decay a busy cell would wrap to empty
+        for (size_t i = 0; i < _grid.size(); i++) {
+            const uint64_t sum = (uint64_t)_grid[i] + w.grid[i];
+            _grid[i] = sum > UINT32_MAX ? UINT32_MAX : (uint32_t)sum;
+        }
+        std::fill(w.grid.begin(), w.grid.end(), 0);
+        frames += w.frames;
+        w.frames = 0;
+    }
+    return frames;
+}
+
+const std::vector<uint32_t> &PersistenceMap::grid() const
+{
+    return _grid;
+}
+
+unsigned int PersistenceMap::columns() const
+{
+    return _columns;
+}
+
+uint64_t PersistenceMap::get_skipped() const
+{
+    return _skipped;
+}
+
+void PersistenceMap::worker_proc(worker *w)
+{
+    while (true) {
+        job j = w->queue.take();
+        if (j.stop)
+            break;
+
+        TRACE_SCOPE("persistence_bin");
+        const size_t len = j.samples->size();
+        const unsigned int columns = (unsigned int)std::min<size_t>(j.columns, len);
+        if (columns == 0) {
+            _free.put(j.samples);
+            continue;
+        }
+
+        boost::lock_guard<boost::mutex> lock(w->mutex);
+        // a new generation or a new geometry starts an empty grid
+        if (w->generation != j.generation || w->columns != columns) {
+            w->grid.assign((size_t)columns * Rows, 0);
+            w->columns = columns;
+            w->generation = j.generation;
+            w->frames = 0;
+            w->column_len = 0;
+        }
+        if (w->column_len != len) {
+            w->column_of.resize(len);
+            for (size_t i = 0; i < len; i++)
+                w->column_of[i] = (uint16_t)(i * columns / len);
+            w->column_len = len;
+        }
+        bin(*w, j.samples->data(), len);
+        w->frames++;
+        _free.put(j.samples);
+    }
+}
+
+// grid[sample * columns + column]++, the cell indexes are computed eight
+// at a time, SSE2 has no scatter so the increments stay scalar
+void PersistenceMap::bin(worker &w, const uint8_t *data, size_t len)
+{
+    uint32_t *grid = w.grid.data();
+    const uint16_t *column_of = w.column_of.data();
+    const uint32_t columns = w.columns;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // (sample, column) pairs times (columns, 1), both fit 15 bits
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mul = _mm_set1_epi32((int)(columns | (1u << 16)));
+    uint32_t cells[8] __attribute__((aligned(16)));
+    for (; i + 8 <= len; i += 8) {
+        const __m128i x = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(data + i)), zero);
+        const __m128i c = _mm_loadu_si128((const __m128i *)(column_of + i));
+        _mm_store_si128((__m128i *)cells, _mm_madd_epi16(_mm_unpacklo_epi16(x, c), mul));
+        _mm_store_si128((__m128i *)(cells + 4), _mm_madd_epi16(_mm_unpackhi_epi16(x, c), mul));
+        for (int k = 0; k < 8; k++)
+            grid[cells[k]]++;
+    }
+#endif
+    for (; i < len; i++)
+        grid[data[i] * columns + column_of[i]]++;
+}
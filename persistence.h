@@ -0,0 +1,120 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _PERSISTENCE_H_
+#define _PERSISTENCE_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <boost/thread.hpp>
+
+#include "blockingqueue.hpp"
+#include "dsoframe.h"
+
+/**
+ * Waveform density map, the hit count of every (time, amplitude) cell
+ * over all frames captured, like the phosphor of an analog scope.
+ *
+ * Frames are binned by a set of worker threads, each into its own partial
+ * grid, so no increment is shared between threads. merge() adds the
+ * partial grids to the persistent grid after decaying it, a cell keeps
+ * decay of its hits per merge, the counts saturate at UINT32_MAX. A frame
+ * is mapped onto at most columns time bins, the rows are the 256 raw
+ * sample values, row-major.
+ *
+ * Frames are copied into buffers the map owns, MaxPending per worker,
+ * so binning never holds a capture buffer. A frame is skipped when all of
+ * them are in use or the worker it would go to has MaxPending queued.
+ */
+class PersistenceMap
+{
+public:
+    static const unsigned int Rows = 256;
+    static const unsigned int DefaultColumns = 1024;
+    static const unsigned int MaxColumns = 16384;
+    static const unsigned int MaxWorkers = 16;
+    static const size_t MaxPending = 4;
+
+public:
+    PersistenceMap();
+    ~PersistenceMap();
+
+    // start workers binning threads, stops the running ones first
+    void start(unsigned int workers);
+    void stop();
+    bool running() const;
+
+    unsigned int get_columns() const;
+    void set_columns(unsigned int columns);
+
+    double get_decay() const;
+    void set_decay(double decay);
+
+    // forget all hits, frames queued before are not binned
+    void clear();
+
+    /**
+     * Queue a frame for binning.
+     * @return false when the frame was skipped because the workers fall behind
+     */
+    bool add(const DsoFrame &frame);
+
+    /**
+     * Decay the grid and add the hits binned since the last merge.
+     * @return the number of frames merged
+     */
+    uint64_t merge();
+
+    // the merged grid, columns() * Rows cells
+    const std::vector<uint32_t> &grid() const;
+
+    // time bins of the merged grid, 0 before the first frame was merged
+    unsigned int columns() const;
+
+    uint64_t get_skipped() const;
+
+private:
+    struct job {
+        std::vector<uint8_t> *samples;
+        uint64_t generation;
+        unsigned int columns;
+        bool stop;
+    };
+
+    struct worker {
+        BlockingQueue<job> queue;
+        boost::mutex mutex;
+        std::vector<uint32_t> grid;
+        std::vector<uint16_t> column_of;
+        size_t column_len;
+        unsigned int columns;
+        uint64_t generation;
+        uint64_t frames;
+        std::unique_ptr<boost::thread> thread;
+    };
+
+    void worker_proc(worker *w);
+    static void bin(worker &w, const uint8_t *data, size_t len);
+
+private:
+    std::vector<std::unique_ptr<worker> > _workers;
+    size_t _next;
+
+    // the copies of the queued frames, and the ones free to copy into
+    std::vector<std::unique_ptr<std::vector<uint8_t> > > _buffers;
+    BlockingQueue<std::vector<uint8_t> *> _free;
+
+    std::atomic<unsigned int> _req_columns;
+    std::atomic<uint64_t> _generation;
+    std::atomic<uint64_t> _skipped;
+
+    std::vector<uint32_t> _grid;
+    unsigned int _columns;
+    uint64_t _grid_generation;
+    double _decay;
+};
+
+#endif  // _PERSISTENCE_H_
@@ -21,8 +21,18 @@
  */
 #include "sigsession.h"
 #include "devicemanager.h"
+#include "allocaudit.h"
+#include "tracer.h"
+#include "logbridge.h"
 
 #include <boost/foreach.hpp>
+#include <chrono>
+#include <sstream>
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
 
 //using boost::dynamic_pointer_cast;
 //using boost::function;
@@ -42,10 +52,17 @@ using namespace std;
 
 //namespace pv {
 
+static int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 // TODO: This should not be necessary
 SigSession *SigSession::_session = NULL;
 
-SigSession::SigSession(DeviceManager &device_manager, BlockingQueue<sr_datafeed_dso> &dso_queue) :
+std::atomic<bool> SigSession::_memory_locked(false);
+
+SigSession::SigSession(DeviceManager &device_manager, BlockingQueue<DsoFrame> &dso_queue) :
         _device_manager(device_manager),
         _dso_queue(dso_queue),
         _capture_state(Init),
@@ -60,10 +77,47 @@ SigSession::SigSession(DeviceManager &device_manager, BlockingQueue<sr_datafeed_
     _session = this;
     _hot_attach = false;
     _hot_detach = false;
+    _hotplug_registered = false;
+    _hotplug_stop = false;
+    _hot_event_ms = 0;
+    _device_lost = false;
+    _detach_count = 0;
+    _attach_count = 0;
+    _resume_on_attach = false;
+    _resume_instant = false;
+    _has_tap = false;
+    _watchdog_stop = false;
+    _watchdog_enabled = true;
+    _watchdog_level = 0;
+    _watchdog_progress = -1;
+    _watchdog_reopen_streak = 0;
+    _watchdog_backoff_ms = 0;
+    _watchdog_armed_ms = 0;
+    _watchdog_wait_ms = 0;
+    _watchdog_armed_limit_ms = 0;
+    _last_packet_ms = 0;
+    _watchdog_capture_restarts = 0;
+    _watchdog_session_restarts = 0;
+    _watchdog_reopens = 0;
+    _watchdog_armed_timeouts = 0;
     _group_cnt = 0;
     _noData_cnt = 0;
     _data_lock = false;
     _data_updated = false;
+    _cur_vdiv = 0;
+    _dso_ch_num = 1;
+    _dropped_frames = 0;
+    _overflows = 0;
+    _packet_errors = 0;
+    _frame_seq = 0;
+    _sample_pos = 0;
+    _discontinuity = false;
+    _config_pending = false;
+    _reconfigured = false;
+    _config_gen = 0;
+    _applied_config_gen = 0;
+    _sched_policy = SCHED_OTHER;
+    _sched_priority = 0;
 
     //_cur_dso_snapshot.reset(new DsoSnapshot());
     //_dso_data.reset(new Dso());
@@ -71,19 +125,23 @@ SigSession::SigSession(DeviceManager &device_manager, BlockingQueue<sr_datafeed_
 }
 
 SigSession::~SigSession() {
-    std::cout << __func__ << " has been called!" << std::endl;
+    DS_LOG(SR_LOG_DBG, "%s has been called!", __func__);
     stop_capture();
 
     ds_trigger_destroy();
 
-    _dev_inst->release();
+    // the release clears _dev_inst, keep the instance until it returns
+    boost::shared_ptr<DevInst> dev_inst = _dev_inst;
+    if (dev_inst)
+        dev_inst->release();
 
     // TODO: This should not be necessary
-    std::cout << __func__ << " end!" << std::endl;
+    DS_LOG(SR_LOG_DBG, "%s end!", __func__);
     _session = NULL;
 }
 
 boost::shared_ptr<DevInst> SigSession::get_device() const {
+    boost::lock_guard<boost::recursive_mutex> lock(_control_mutex);
     return _dev_inst;
 }
 
@@ -93,12 +151,19 @@ void SigSession::set_device(boost::shared_ptr<DevInst> dev_inst) {
     // Ensure we are not capturing before setting the device
     //stop_capture();
 
-    if (_dev_inst) {
+    boost::lock_guard<boost::recursive_mutex> lock(_control_mutex);
+    // the release clears _dev_inst, the new one is set after it
+    boost::shared_ptr<DevInst> old_inst = _dev_inst;
+    if (old_inst) {
         sr_session_datafeed_callback_remove_all();
-        _dev_inst->release();
+        old_inst->release();
     }
 
-    _dev_inst = dev_inst;
+    {
+        // a sampling thread ending right now may still apply a change
+        boost::lock_guard<boost::mutex> config_lock(_config_mutex);
+        _dev_inst = dev_inst;
+    }
 
     if (_dev_inst) {
         try {
@@ -111,7 +176,7 @@ void SigSession::set_device(boost::shared_ptr<DevInst> dev_inst) {
             else
                 set_run_mode(Single);
         } catch (std::exception) {
-            std::cout << "set_device failed!" << std::endl;
+            DS_LOG(SR_LOG_ERR, "set_device failed!");
             return;
         }
         sr_session_datafeed_callback_add(data_feed_in_proc, NULL);
@@ -137,19 +202,17 @@ void SigSession::set_default_device() {
         try {
             set_device(default_device);
         } catch (std::exception e) {
-            std::cout << "set device error!" << std::endl;
+            DS_LOG(SR_LOG_ERR, "set device error!");
             return;
         }
     }
 }
 
 void SigSession::release_device(DevInst *dev_inst) {
-    (void) dev_inst;
-    assert(_dev_inst.get() == dev_inst);
-
     assert(get_capture_state() != Running);
-    _dev_inst = boost::shared_ptr<DevInst>();
-    _dev_inst.reset();
+    boost::lock_guard<boost::mutex> config_lock(_config_mutex);
+    if (_dev_inst.get() == dev_inst)
+        _dev_inst.reset();
 }
 
 SigSession::capture_state SigSession::get_capture_state() const {
@@ -161,6 +224,10 @@ uint64_t SigSession::cur_samplelimits() const {
     return _cur_samplelimits;
 }
 
+uint64_t SigSession::cur_vdiv() const {
+    return _cur_vdiv;
+}
+
 uint64_t SigSession::cur_samplerate() const {
     return _cur_samplerate;
 }
@@ -186,6 +253,75 @@ void SigSession::set_cur_samplelimits(uint64_t samplelimits) {
     // TODO: populate samplelimits to real device
 }
 
+uint64_t SigSession::queue_config(int key, int ch_index, uint64_t value) {
+    config_change change = {key, ch_index, value};
+    return queue_config(std::vector<config_change>(1, change));
+}
+
+uint64_t SigSession::queue_config(const std::vector<config_change> &changes) {
+    // the hotplug and watchdog threads swap _dev_inst and _sampling_thread
+    // under the control lock
+    boost::lock_guard<boost::recursive_mutex> control_lock(_control_mutex);
+    boost::lock_guard<boost::mutex> lock(_config_mutex);
+    const uint64_t gen = ++_config_gen;
+
+    // without a device the change waits for the re-attach
+    if (!_dev_inst || (_sampling_thread.get() && get_capture_state() == Running)) {
+        _pending_config.insert(_pending_config.end(), changes.begin(), changes.end());
+        _config_pending = true;
+    } else {
+        BOOST_FOREACH(const config_change &change, changes)
+            apply_config(change);
+        _applied_config_gen = gen;
+    }
+    return gen;
+}
+
+void SigSession::apply_config(const config_change &change) {
+    TRACE_SCOPE("apply_config");
+    assert(_dev_inst);
+
+    switch (change.key) {
+        case SR_CONF_SAMPLERATE:
+            _dev_inst->set_sample_rate(change.value);
+            _cur_samplerate = _dev_inst->get_sample_rate();
+            break;
+
+        case SR_CONF_LIMIT_SAMPLES:
+            _dev_inst->set_limit_samples(change.value);
+            _cur_samplelimits = _dev_inst->get_sample_limit();
+            break;
+
+        case SR_CONF_PROBE_VDIV:
+            _dev_inst->set_voltage_div(change.ch_index, change.value);
+            if (change.ch_index == 0)
+                _cur_vdiv = _dev_inst->get_voltage_div(0);
+            break;
+
+        case SR_CONF_TRIGGER_VALUE:
+            _dev_inst->set_trigger_value(change.ch_index, (uint8_t)change.value);
+            break;
+
+        default:
+            DS_LOG(SR_LOG_WARN, "unsupported config key %d", change.key);
+            return;
+    }
+    _applied_config[std::make_pair(change.key, change.ch_index)] = change.value;
+    _reconfigured = true;
+}
+
+// called by the sampling thread between two frames
+void SigSession::apply_pending_config() {
+    if (!_config_pending)
+        return;
+
+    boost::lock_guard<boost::mutex> lock(_config_mutex);
+    BOOST_FOREACH(const config_change &change, _pending_config)
+        apply_config(change);
+    _pending_config.clear();
+    _config_pending = false;
+    _applied_config_gen = _config_gen;
+}
 
 void SigSession::init_signals() {
     assert(_dev_inst);
@@ -227,7 +363,31 @@ void SigSession::init_signals() {
 void SigSession::capture_init() {
     _cur_samplerate = _dev_inst->get_sample_rate();
     _cur_samplelimits = _dev_inst->get_sample_limit();
+    _cur_vdiv = _dev_inst->get_voltage_div(0);
+    _reconfigured = false;
+
+    _watchdog_armed_ms = steady_ms();
+    _watchdog_wait_ms = _watchdog_armed_ms.load();
+    _watchdog_progress = -1;
+
+    // a (re-)armed capture does not continue the previous stream
+    _frame_seq = 0;
+    _sample_pos = 0;
+    _discontinuity = true;
+
+    // dso packets interleave the samples of the enabled channels
+    _dso_ch_num = 0;
+    _ch_enabled.clear();
+    for (const GSList *l = _dev_inst->dev_inst()->channels; l; l = l->next) {
+        const sr_channel *const probe = (const sr_channel *) l->data;
+        if (probe->type == SR_CHANNEL_DSO && probe->enabled)
+            _dso_ch_num++;
+        _ch_enabled.push_back(std::make_pair((int) probe->index, (bool) probe->enabled));
+    }
+    if (_dso_ch_num == 0)
+        _dso_ch_num = 1;
     _data_updated = false;
+    _data_lock = false;
     _trigger_flag = false;
     _hw_replied = false;
     _noData_cnt = 0;
@@ -240,9 +400,11 @@ void SigSession::capture_init() {
 
 
 void SigSession::start_capture(bool instant) {
+    boost::lock_guard<boost::recursive_mutex> lock(_control_mutex);
+
     // Check that a device instance has been selected.
     if (!_dev_inst) {
-        std::cout << "No device selected";
+        DS_LOG(SR_LOG_ERR, "No device selected");
         return;
     }
     assert(_dev_inst->dev_inst());
@@ -260,6 +422,10 @@ void SigSession::start_capture(bool instant) {
         _instant = instant;
     else
         _instant = true;
+
+    // in instant mode the driver hands over each USB packet as it arrives
+    // instead of whole frames, the frame becomes a roll buffer
+    _dev_inst->set_config(NULL, NULL, SR_CONF_INSTANT, g_variant_new_boolean(_instant));
     capture_init();
 
     // Check that at least one probe is enabled
@@ -271,7 +437,7 @@ void SigSession::start_capture(bool instant) {
             break;
     }
     if (!l) {
-        std::cout << "No probes enabled." << std::endl;
+        DS_LOG(SR_LOG_ERR, "No probes enabled.");
         return;
     }
 
@@ -281,6 +447,8 @@ void SigSession::start_capture(bool instant) {
 }
 
 void SigSession::stop_capture() {
+    boost::lock_guard<boost::recursive_mutex> lock(_control_mutex);
+    _resume_on_attach = false;
     _instant = false;
 
     if (get_capture_state() != Running)
@@ -293,6 +461,156 @@ void SigSession::stop_capture() {
     _sampling_thread.reset();
 }
 
+void SigSession::pause_capture() {
+    _data_lock = true;
+    _dso_queue.clear();
+}
+
+void SigSession::resume_capture(bool instant) {
+    boost::lock_guard<boost::recursive_mutex> lock(_control_mutex);
+    if (_device_lost) {
+        // the hotplug thread starts it once the device is back
+        _resume_on_attach = true;
+        _resume_instant = instant;
+        _data_lock = false;
+        return;
+    }
+
+    if (_sampling_thread.get() && get_capture_state() == Running &&
+        _instant == instant) {
+        // frames queued before the pause are stale
+        _dso_queue.clear();
+        _data_lock = false;
+        return;
+    }
+
+    start_capture(instant);
+}
+
+bool SigSession::is_paused() const {
+    return _data_lock;
+}
+
+bool SigSession::set_sampling_sched(int policy, int priority, std::string &error) {
+    if (policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR) {
+        error = "unknown scheduling policy";
+        return false;
+    }
+    if (priority < sched_get_priority_min(policy) ||
+        priority > sched_get_priority_max(policy)) {
+        std::ostringstream os;
+        os << "priority " << priority << " out of range ["
+           << sched_get_priority_min(policy) << ", "
+           << sched_get_priority_max(policy) << "] for this policy";
+        error = os.str();
+        return false;
+    }
+
+    // _sampling_thread is swapped under the control lock
+    boost::lock_guard<boost::recursive_mutex> control_lock(_control_mutex);
+    boost::lock_guard<boost::mutex> lock(_sched_mutex);
+    const int old_policy = _sched_policy;
+    const int old_priority = _sched_priority;
+    _sched_policy = policy;
+    _sched_priority = priority;
+    if (!try_sched(error)) {
+        // later sampling threads keep the settings that worked
+        _sched_policy = old_policy;
+        _sched_priority = old_priority;
+        std::string ignored;
+        if (_sampling_thread.get())
+            apply_sched(_sampling_thread->native_handle(), ignored);
+        return false;
+    }
+    return true;
+}
+
+bool SigSession::set_sampling_affinity(const std::vector<int> &cpus, std::string &error) {
+    BOOST_FOREACH(int cpu, cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            error = "invalid CPU number " + std::to_string(cpu);
+            return false;
+        }
+    }
+
+    boost::lock_guard<boost::recursive_mutex> control_lock(_control_mutex);
+    boost::lock_guard<boost::mutex> lock(_sched_mutex);
+    const std::vector<int> old_cpus = _sched_cpus;
+    _sched_cpus = cpus;
+    if (!try_sched(error)) {
+        _sched_cpus = old_cpus;
+        std::string ignored;
+        if (_sampling_thread.get())
+            apply_sched(_sampling_thread->native_handle(), ignored);
+        return false;
+    }
+    return true;
+}
+
+// apply the settings to the sampling thread, or without one to a thread
+// started just to try them, so a missing privilege shows up right away
+bool SigSession::try_sched(std::string &error) {
+    if (_sampling_thread.get())
+        return apply_sched(_sampling_thread->native_handle(), error);
+    bool ok = false;
+    boost::thread probe([this, &ok, &error]() {
+        ok = apply_sched(pthread_self(), error);
+    });
+    probe.join();
+    return ok;
+}
+
+bool SigSession::apply_sched(pthread_t thread, std::string &error) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = _sched_priority;
+
+    int ret = pthread_setschedparam(thread, _sched_policy, &param);
+    if (ret != 0) {
+        error = std::string("set scheduling policy failed: ") + strerror(ret);
+        if (ret == EPERM)
+            error += " (needs CAP_SYS_NICE or an rtprio limit)";
+        return false;
+    }
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (_sched_cpus.empty()) {
+        // back to the CPUs of the process
+        if (sched_getaffinity(0, sizeof(cpuset), &cpuset) != 0)
+            return true;
+    } else {
+        BOOST_FOREACH(int cpu, _sched_cpus)
+            CPU_SET(cpu, &cpuset);
+    }
+    ret = pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset);
+    if (ret != 0) {
+        error = std::string("set CPU affinity failed: ") + strerror(ret);
+        if (ret == EINVAL)
+            error += " (no CPU of the set is available)";
+        return false;
+    }
+    return true;
+}
+
+bool SigSession::lock_memory(bool lock, std::string &error) {
+    if (lock == _memory_locked)
+        return true;
+
+    if (lock && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        error = std::string("mlockall failed: ") + strerror(errno);
+        if (errno == ENOMEM || errno == EPERM)
+            error += " (RLIMIT_MEMLOCK too low, needs CAP_IPC_LOCK)";
+        return false;
+    }
+    if (!lock && munlockall() != 0) {
+        error = std::string("munlockall failed: ") + strerror(errno);
+        return false;
+    }
+    _memory_locked = lock;
+    return true;
+}
+
 bool SigSession::get_capture_status(bool &triggered, int &progress) {
     uint64_t sample_limits = cur_samplelimits();
     sr_status status;
@@ -325,14 +643,33 @@ void SigSession::set_capture_state(capture_state state) {
 }
 
 void SigSession::sample_thread_proc(boost::shared_ptr<DevInst> dev_inst) {
+    TRACE_SCOPE("sample_thread_proc");
     assert(dev_inst);
     assert(dev_inst->dev_inst());
     //std::cout << "in func :" << __func__ << std::endl;
+    {
+        std::string error;
+        boost::lock_guard<boost::mutex> lock(_sched_mutex);
+        if (!apply_sched(pthread_self(), error))
+            DS_LOG(SR_LOG_WARN, "sampling thread: %s", error.c_str());
+    }
+
+    if (_memory_locked) {
+        // touch the stack now, not on the first deep call while sampling
+        volatile uint8_t stack[256 * 1024];
+        for (size_t i = 0; i < sizeof(stack); i += 4096)
+            stack[i] = 0;
+    }
+    // the frame buffers too, they are locked with the rest when mlockall
+    // is on, roll mode packets are much smaller than the limit
+    if (!_instant)
+        _frame_pool.reserve((size_t)_cur_samplelimits * _dso_ch_num);
+
     try {
         dev_inst->start();
     } catch (std::exception) {
         //error_handler(e);
-        std::cout << "dev_inst start failed!" << std::endl;
+        DS_LOG(SR_LOG_ERR, "dev_inst start failed!");
         return;
     }
 
@@ -343,20 +680,37 @@ void SigSession::sample_thread_proc(boost::shared_ptr<DevInst> dev_inst) {
     set_capture_state(Stopped);
 }
 
+static int64_t wall_time_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 void SigSession::data_feed_in(const struct sr_dev_inst *sdi,
                               const struct sr_datafeed_packet *packet) {
     assert(sdi);
     assert(packet);
 
+    ALLOC_AUDIT_SCOPE();
+    TRACE_SCOPE("data_feed_in");
+
+    // the watchdog only needs to know that the device still delivers
+    if (packet->type == SR_DF_DSO)
+        _last_packet_ms = steady_ms();
     //boost::lock_guard<boost::mutex> lock(_data_mutex);
 
-    if (_data_lock)
+    if (_data_lock) {
+        // still a frame boundary, keep reconfiguring while paused
+        if (packet->type == SR_DF_DSO)
+            apply_pending_config();
+        return;
+    }
+    if (packet->type != SR_DF_END &&
+        packet->status != SR_PKT_OK) {
+        _packet_errors++;
+        _discontinuity = true;
+        _error = Pkt_data_err;
         return;
-    //if (packet->type != SR_DF_END &&
-    //    packet->status != SR_PKT_OK) {
-    //    _error = Pkt_data_err;
-    //    return;
-   // }
+    }
 
     switch (packet->type) {
         case SR_DF_HEADER:
@@ -380,7 +734,8 @@ void SigSession::data_feed_in(const struct sr_dev_inst *sdi,
 
         case SR_DF_DSO:
             assert(packet->payload);
-            feed_in_dso(*(const sr_datafeed_dso *) packet->payload);
+            feed_in_dso(*(const sr_datafeed_dso *) packet->payload, wall_time_ns());
+            apply_pending_config();
             break;
 
         case SR_DF_ANALOG:
@@ -388,13 +743,15 @@ void SigSession::data_feed_in(const struct sr_dev_inst *sdi,
             //feed_in_analog(*(const sr_datafeed_analog*)packet->payload);
             break;
 
-        //case SR_DF_OVERFLOW: {
-        //    if (_error == No_err) {
-        //        _error = Data_overflow;
+        case SR_DF_OVERFLOW: {
+            _overflows++;
+            _discontinuity = true;
+            if (_error == No_err) {
+                _error = Data_overflow;
 //            session_error();
-        //    }
-        //    break;
-        //}
+            }
+            break;
+        }
         /*
         case SR_DF_END: {
             //_cur_dso_snapshot->capture_ended();
@@ -416,9 +773,47 @@ void SigSession::data_feed_in_proc(const struct sr_dev_inst *sdi,
 }
 
 
-void SigSession::feed_in_dso(const sr_datafeed_dso &dso) {
+void SigSession::feed_in_dso(const sr_datafeed_dso &dso, int64_t timestamp_ns) {
+    TRACE_SCOPE("feed_in_dso");
     //std::cout << dso.num_samples << std::endl;
-    _dso_queue.put(dso);
+    // dropped packets still count, the consumer sees the gap
+    const uint64_t seq = _frame_seq++;
+    const uint64_t sample_pos = _sample_pos;
+    _sample_pos += dso.num_samples;
+
+    DsoFrame frame;
+    frame.dso = dso;
+    frame.bytes = (size_t) dso.num_samples * _dso_ch_num;
+    frame.samplerate = _cur_samplerate;
+    frame.limit = _cur_samplelimits;
+    frame.vdiv = _cur_vdiv;
+    frame.reconfigured = _reconfigured;
+    frame.config_gen = _applied_config_gen;
+    frame.seq = seq;
+    frame.sample_pos = sample_pos;
+    frame.timestamp_ns = timestamp_ns;
+    frame.discontinuity = _discontinuity;
+
+    if (_has_tap) {
+        boost::lock_guard<boost::mutex> lock(_tap_mutex);
+        if (_frame_tap)
+            _frame_tap(frame);
+    }
+
+    // the only copy on the host, libsigrok re-uses its transfer buffer
+    std::shared_ptr<uint8_t> buffer = _frame_pool.acquire(frame.bytes);
+    if (!buffer) {
+        // the next queued frame carries the change and the gap
+        _dropped_frames++;
+        return;
+    }
+    memcpy(buffer.get(), dso.data, frame.bytes);
+    frame.dso.data = buffer.get();
+    frame.buffer = buffer;
+    _reconfigured = false;
+    _discontinuity = false;
+    TRACE_SCOPE("queue_put");
+    _dso_queue.put(frame);
 }
 
 /*
@@ -481,6 +876,37 @@ uint64_t SigSession::get_error_pattern() const {
     return _error_pattern;
 }
 
+uint64_t SigSession::get_dropped_frames() const {
+    return _dropped_frames;
+}
+
+uint64_t SigSession::get_overflows() const {
+    return _overflows;
+}
+
+void SigSession::set_frame_tap(const frame_tap &tap) {
+    boost::lock_guard<boost::mutex> lock(_tap_mutex);
+    _frame_tap = tap;
+    _has_tap = (bool)tap;
+}
+
+uint64_t SigSession::get_packet_errors() const {
+    return _packet_errors;
+}
+
+const char *SigSession::error_string(error_state state) {
+    switch (state) {
+        case No_err: return "No_err";
+        case Hw_err: return "Hw_err";
+        case Malloc_err: return "Malloc_err";
+        case Test_data_err: return "Test_data_err";
+        case Test_timeout_err: return "Test_timeout_err";
+        case Pkt_data_err: return "Pkt_data_err";
+        case Data_overflow: return "Data_overflow";
+    }
+    return "unknown";
+}
+
 SigSession::run_mode SigSession::get_run_mode() const {
     return _run_mode;
 }
@@ -513,84 +939,362 @@ int SigSession::hotplug_callback(struct libusb_context *ctx, struct libusb_devic
 
     if (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED == event) {
         _session->_hot_attach = true;
-        printf("DreamSourceLab Hardware Attached!\n");
+        DS_LOG(SR_LOG_INFO, "DreamSourceLab Hardware Attached!");
     } else if (LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT == event) {
         _session->_hot_detach = true;
-        printf("DreamSourceLab Hardware Detached!\n");
+        DS_LOG(SR_LOG_INFO, "DreamSourceLab Hardware Detached!");
     } else {
-        printf("Unhandled event %d\n", event);
+        DS_LOG(SR_LOG_WARN, "Unhandled event %d", event);
+        return 0;
     }
+    _session->_hot_event_ms = steady_ms();
 
     return 0;
 }
 
 void SigSession::hotplug_proc() {
-    struct timeval tv;
+    while (!_hotplug_stop) {
+        // sleeps in libusb until an event arrives, the timeout only
+        // bounds how long stop_hotplug_proc() waits
+        const bool pending = _hot_attach || _hot_detach;
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = (pending ? HotplugSettleMs : HotplugWaitMs) * 1000;
+        libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+
+        if (_hotplug_stop)
+            break;
+        if (!(_hot_attach || _hot_detach) ||
+            steady_ms() - _hot_event_ms < HotplugSettleMs)
+            continue;
 
-    if (!_dev_inst)
+        try {
+            if (_hot_detach.exchange(false))
+                device_detach();
+            if (_hot_attach.exchange(false))
+                device_attach();
+        } catch (std::exception &e) {
+            DS_LOG(SR_LOG_ERR, "hotplug: %s", e.what());
+        }
+    }
+    DS_LOG(SR_LOG_INFO, "Hotplug thread exit!");
+}
+
+void SigSession::device_detach() {
+    boost::lock_guard<boost::recursive_mutex> lock(_control_mutex);
+    if (_device_lost || !_dev_inst)
         return;
 
-    tv.tv_sec = tv.tv_usec = 0;
-    try {
-        while (_session) {
-            libusb_handle_events_timeout(NULL, &tv);
-            if (_hot_attach) {
-                printf("DreamSourceLab hardware attached!");
-                //device_attach();
-                _device_manager.scan_all_drivers();
-                set_default_device();
-                get_device()->set_ch_enable(1, false);
-                get_device()->set_limit_samples(2048);
-                //stop_hotplug_proc();
-                //deregister_hotplug_callback();
-                _hot_attach = false;
-            }
-            if (_hot_detach) {
-                printf("DreamSourceLab hardware detached!");
-                //device_detach();
-                _device_manager.scan_all_drivers();
-                set_default_device();
-                _hot_detach = false;
+    drop_device();
+    _detach_count++;
+    DS_LOG(SR_LOG_WARN, "device %s lost, waiting for it to come back", _driver_name.c_str());
+
+    // another DreamSourceLab device may have left, ours is then still there
+    device_attach();
+}
+
+// release the device, device_attach() resumes the capture on a new one
+void SigSession::drop_device() {
+    // the sampling thread may have ended on the USB errors already
+    const bool capturing = _sampling_thread.get() != NULL;
+    const bool instant = _instant;
+    stop_capture();
+    _resume_on_attach = capturing;
+    _resume_instant = instant;
+    set_device(boost::shared_ptr<DevInst>());
+    _device_lost = true;
+}
+
+// bring a new or re-opened device to the configuration of the old one
+void SigSession::restore_config() {
+    boost::lock_guard<boost::mutex> config_lock(_config_mutex);
+    typedef std::pair<int, bool> ch_state;
+    BOOST_FOREACH(const ch_state &ch, _ch_enabled)
+        _dev_inst->set_ch_enable(ch.first, ch.second);
+
+    typedef std::pair<const std::pair<int, int>, uint64_t> config_entry;
+    BOOST_FOREACH(const config_entry &entry, _applied_config) {
+        config_change change = {entry.first.first, entry.first.second, entry.second};
+        apply_config(change);
+    }
+    BOOST_FOREACH(const config_change &change, _pending_config)
+        apply_config(change);
+    _pending_config.clear();
+    _config_pending = false;
+    _applied_config_gen = _config_gen;
+}
+
+void SigSession::device_attach() {
+    boost::lock_guard<boost::recursive_mutex> lock(_control_mutex);
+    if (!_device_lost)
+        return;
+
+    // only the driver of the lost device is scanned again
+    struct sr_dev_driver **const drivers = sr_driver_list();
+    for (struct sr_dev_driver **driver = drivers; *driver; driver++)
+        if (_driver_name == (*driver)->name)
+            _device_manager.driver_scan(*driver);
+    set_default_device();
+    if (!_dev_inst || _dev_inst->name() != _driver_name) {
+        set_device(boost::shared_ptr<DevInst>());
+        return;
+    }
+
+    restore_config();
+    _device_lost = false;
+    _attach_count++;
+    DS_LOG(SR_LOG_INFO, "device %s is back", _driver_name.c_str());
+
+    if (_resume_on_attach) {
+        // pause_capture() and resume_capture() kept _data_lock up to date
+        const bool paused = _data_lock;
+        _resume_on_attach = false;
+        start_capture(_resume_instant);
+        _data_lock = paused;
+    }
+}
+
+void SigSession::start_watchdog() {
+    if (_watchdog.get())
+        return;
+    _watchdog_stop = false;
+    _watchdog.reset(new boost::thread(&SigSession::watchdog_proc, this));
+}
+
+void SigSession::stop_watchdog() {
+    if (_watchdog.get()) {
+        {
+            boost::lock_guard<boost::mutex> lock(_watchdog_mutex);
+            _watchdog_stop = true;
+        }
+        _watchdog_cond.notify_all();
+        _watchdog->join();
+    }
+    _watchdog.reset();
+}
+
+void SigSession::set_watchdog_enabled(bool enable) {
+    _watchdog_enabled = enable;
+}
+
+bool SigSession::get_watchdog_enabled() const {
+    return _watchdog_enabled;
+}
+
+uint64_t SigSession::get_watchdog_capture_restarts() const {
+    return _watchdog_capture_restarts;
+}
+
+uint64_t SigSession::get_watchdog_session_restarts() const {
+    return _watchdog_session_restarts;
+}
+
+uint64_t SigSession::get_watchdog_reopens() const {
+    return _watchdog_reopens;
+}
+
+void SigSession::set_watchdog_armed_limit(int64_t ms) {
+    _watchdog_armed_limit_ms = std::max<int64_t>(0, ms);
+}
+
+int64_t SigSession::get_watchdog_armed_limit() const {
+    return _watchdog_armed_limit_ms;
+}
+
+uint64_t SigSession::get_watchdog_armed_timeouts() const {
+    return _watchdog_armed_timeouts;
+}
+
+void SigSession::watchdog_proc() {
+    boost::unique_lock<boost::mutex> lock(_watchdog_mutex);
+    while (!_watchdog_stop) {
+        _watchdog_cond.wait_for(lock, boost::chrono::milliseconds(WatchdogPollMs));
+        if (_watchdog_stop)
+            break;
+        lock.unlock();
+        try {
+            watchdog_check();
+        } catch (std::exception &e) {
+            DS_LOG(SR_LOG_ERR, "watchdog: %s", e.what());
+        }
+        lock.lock();
+    }
+}
+
+// how long a capture may go without a packet, a few frame periods
+int64_t SigSession::stall_timeout_ms() const {
+    const uint64_t samplerate = _cur_samplerate;
+    const int64_t period = samplerate ? (int64_t)(_cur_samplelimits * 1000 / samplerate) : 0;
+    return std::max<int64_t>(WatchdogMinStallMs, WatchdogPeriods * period);
+}
+
+void SigSession::watchdog_check() {
+    // skip the round while a capture is being started or stopped
+    boost::unique_lock<boost::recursive_mutex> lock(_control_mutex, boost::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+
+    if (!_watchdog_enabled || _device_lost || !_dev_inst || !_sampling_thread.get()) {
+        _watchdog_level = 0;
+        return;
+    }
+
+    const int64_t now = steady_ms();
+    const int64_t last = _last_packet_ms;
+    if (last > _watchdog_armed_ms) {
+        // packets arrive again, the next stall starts over at the first step
+        _watchdog_armed_ms = last;
+        _watchdog_wait_ms = last;
+        _watchdog_level = 0;
+        _watchdog_reopen_streak = 0;
+        _watchdog_backoff_ms = 0;
+    }
+    if (now - _watchdog_armed_ms < stall_timeout_ms() + _watchdog_backoff_ms)
+        return;
+
+    // a slow capture still moves the hardware progress, an armed capture
+    // waits for its trigger up to the armed limit, a hung device may
+    // report armed forever
+    bool triggered = false;
+    int progress = 0;
+    if (get_capture_status(triggered, progress)) {
+        if (progress != _watchdog_progress) {
+            _watchdog_progress = progress;
+            _watchdog_armed_ms = now;
+            _watchdog_wait_ms = now;
+            return;
+        }
+        if (!_instant && !triggered) {
+            const int64_t limit = _watchdog_armed_limit_ms ?
+                    (int64_t)_watchdog_armed_limit_ms : WatchdogArmedTimeouts * stall_timeout_ms();
+            if (now - _watchdog_wait_ms < limit) {
+                _watchdog_armed_ms = now;
+                return;
             }
-            boost::this_thread::sleep(boost::posix_time::millisec(100));
+            DS_LOG(SR_LOG_WARN, "watchdog: armed for %d ms without a trigger", (int)(now - _watchdog_wait_ms));
+            _watchdog_armed_timeouts++;
+        }
+    }
+
+    const bool instant = _instant;
+    const bool paused = _data_lock;
+    switch (_watchdog_level) {
+        case 0:
+            DS_LOG(SR_LOG_WARN, "watchdog: no data for %d ms, restarting the capture", (int)(now - _watchdog_armed_ms));
+            _watchdog_capture_restarts++;
+            start_capture(instant);
+            _data_lock = paused;
+            break;
+
+        case 1: {
+            DS_LOG(SR_LOG_WARN, "watchdog: still no data, restarting the session");
+            _watchdog_session_restarts++;
+            boost::shared_ptr<DevInst> dev_inst = _dev_inst;
+            stop_capture();
+            set_device(boost::shared_ptr<DevInst>());
+            set_device(dev_inst);
+            dev_inst->invalidate_config_cache();
+            restore_config();
+            start_capture(instant);
+            _data_lock = paused;
+            break;
         }
-    } catch (...) {
-        printf("Interrupt exception for hotplug thread was thrown.");
+
+        default:
+            if (_watchdog_reopen_streak >= WatchdogMaxReopens) {
+                if (_watchdog_reopen_streak == WatchdogMaxReopens) {
+                    DS_LOG(SR_LOG_ERR, "watchdog: no data after %d re-opens, giving up", WatchdogMaxReopens);
+                    _watchdog_reopen_streak++;
+                }
+                break;
+            }
+            DS_LOG(SR_LOG_WARN, "watchdog: still no data, re-opening the device");
+            _watchdog_reopens++;
+            drop_device();
+            device_attach();
+            // each further re-open waits twice as long
+            _watchdog_backoff_ms = std::min<int64_t>(WatchdogMaxBackoffMs,
+                    stall_timeout_ms() << _watchdog_reopen_streak);
+            _watchdog_reopen_streak++;
+            break;
     }
-    printf("Hotplug thread exit!");
+    if (_watchdog_level < 2)
+        _watchdog_level++;
+    _watchdog_armed_ms = steady_ms();
+    _watchdog_wait_ms = _watchdog_armed_ms.load();
+}
+
+bool SigSession::is_device_lost() const {
+    return _device_lost;
+}
+
+uint64_t SigSession::get_detach_count() const {
+    return _detach_count;
+}
+
+uint64_t SigSession::get_attach_count() const {
+    return _attach_count;
 }
 
 void SigSession::register_hotplug_callback() {
     int ret;
 
+    if (_hotplug_registered)
+        return;
+    if (_dev_inst)
+        _driver_name = _dev_inst->name();
+
+    // the hotplug events come through the default context
+    ret = libusb_init(NULL);
+    if (LIBUSB_SUCCESS != ret) {
+        DS_LOG(SR_LOG_ERR, "libusb_init failed: %s", libusb_error_name(ret));
+        return;
+    }
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        DS_LOG(SR_LOG_WARN, "libusb has no hotplug support");
+        libusb_exit(NULL);
+        return;
+    }
+
+    // no LIBUSB_HOTPLUG_ENUMERATE, the device already attached is open
     ret = libusb_hotplug_register_callback(NULL, (libusb_hotplug_event) (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
                                                                          LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
-                                           (libusb_hotplug_flag) LIBUSB_HOTPLUG_ENUMERATE, 0x2A0E,
+                                           LIBUSB_HOTPLUG_NO_FLAGS, 0x2A0E,
                                            LIBUSB_HOTPLUG_MATCH_ANY,
                                            LIBUSB_HOTPLUG_MATCH_ANY, hotplug_callback, NULL,
                                            &_hotplug_handle);
     if (LIBUSB_SUCCESS != ret) {
-        printf("Error creating a hotplug callback\n");
+        DS_LOG(SR_LOG_ERR, "Error creating a hotplug callback");
+        libusb_exit(NULL);
+        return;
     }
+    _hotplug_registered = true;
 }
 
 void SigSession::deregister_hotplug_callback() {
+    if (!_hotplug_registered)
+        return;
     libusb_hotplug_deregister_callback(NULL, _hotplug_handle);
+    libusb_exit(NULL);
+    _hotplug_registered = false;
 }
 
 void SigSession::start_hotplug_proc() {
 
 // Begin the session
-    printf("Starting a hotplug thread...\n");
+    if (!_hotplug_registered || _hotplug.get())
+        return;
+    DS_LOG(SR_LOG_INFO, "Starting a hotplug thread...");
     _hot_attach = false;
     _hot_detach = false;
+    _hotplug_stop = false;
     _hotplug.reset(new boost::thread(&SigSession::hotplug_proc, this));
 
 }
 
 void SigSession::stop_hotplug_proc() {
     if (_hotplug.get()) {
-        _hotplug->interrupt();
+        _hotplug_stop = true;
         _hotplug->join();
     }
     _hotplug.reset();
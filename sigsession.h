@@ -27,6 +27,8 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
 #include <boost/thread.hpp>
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <utility>
@@ -35,6 +37,7 @@
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <pthread.h>
 
 #include <libsigrok4DSL/libsigrok.h>
 #include <libusb.h>
@@ -42,6 +45,8 @@
 //#include "dso.h"
 //#include "dsosnapshot.h"
 #include "blockingqueue.hpp"
+#include "dsoframe.h"
+#include "framepool.h"
 
 struct srd_decoder;
 struct srd_channel;
@@ -90,7 +95,7 @@ public:
     };
 
 public:
-	SigSession(DeviceManager &device_manager, BlockingQueue<sr_datafeed_dso> &_dso_queue);
+	SigSession(DeviceManager &device_manager, BlockingQueue<DsoFrame> &_dso_queue);
 
 	~SigSession();
 
@@ -109,12 +114,65 @@ public:
 
     uint64_t cur_samplerate() const;
     uint64_t cur_samplelimits() const;
+    uint64_t cur_vdiv() const;
     double cur_sampletime() const;
     void set_cur_samplerate(uint64_t samplerate);
     void set_cur_samplelimits(uint64_t samplelimits);
 
+    struct config_change {
+        int key;
+        int ch_index;
+        uint64_t value;
+    };
+
+    /**
+     * Change a device setting without tearing the current frame.
+     * While capturing, the change is queued and applied by the sampling
+     * thread at the next frame boundary, the first frame captured with
+     * the new setting is flagged as reconfigured. Otherwise it is applied
+     * right away. Supported keys are SR_CONF_SAMPLERATE,
+     * SR_CONF_LIMIT_SAMPLES, SR_CONF_PROBE_VDIV and SR_CONF_TRIGGER_VALUE.
+     * @return the generation of the change, frames with a config_gen at
+     * or after it were captured with the change applied
+     */
+    uint64_t queue_config(int key, int ch_index, uint64_t value);
+
+    // several changes applied together, on the same frame boundary
+    uint64_t queue_config(const std::vector<config_change> &changes);
+
     void start_capture(bool instant);
 	void stop_capture();
+
+    /**
+     * Drop incoming frames but keep the libsigrok session, the USB
+     * transfers and the sampling thread alive.
+     */
+    void pause_capture();
+
+    /**
+     * Resume a paused capture in place, falls back to start_capture()
+     * if no session with the same mode is running.
+     */
+    void resume_capture(bool instant);
+    bool is_paused() const;
+
+    /**
+     * Scheduling of the sampling thread, applied right away to a running
+     * thread and again to every thread started later. policy is
+     * SCHED_OTHER, SCHED_FIFO or SCHED_RR, an empty cpu list means any CPU.
+     * Without a sampling thread the settings are tried on a short lived
+     * thread. Returns false with the reason in error, the previous
+     * settings are kept then.
+     */
+    bool set_sampling_sched(int policy, int priority, std::string &error);
+    bool set_sampling_affinity(const std::vector<int> &cpus, std::string &error);
+
+    /**
+     * Lock all current and future pages of the process into memory,
+     * sampling threads started afterwards pre-fault their stack. The
+     * frame buffers are pre-faulted at every capture start either way.
+     */
+    static bool lock_memory(bool lock, std::string &error);
     void capture_init();
 	void init_signals();
     bool get_capture_status(bool &triggered, int &progress);
@@ -128,35 +186,100 @@ public:
     void clear_error();
     uint64_t get_error_pattern() const;
 
+    // frames dropped because every frame buffer was still in use
+    uint64_t get_dropped_frames() const;
+    // SR_DF_OVERFLOW packets seen, the device lost samples
+    uint64_t get_overflows() const;
+    // packets the driver marked as bad, usually USB transfer errors
+    uint64_t get_packet_errors() const;
+
+    /**
+     * Called by the sampling thread with every frame before it is queued,
+     * also with the frames dropped for want of a buffer, so a tap keeps up
+     * with the device whatever the consumer of the queue does. dso.data is
+     * only valid during the call and buffer is empty, the tap must copy
+     * what it keeps and must not block. An empty tap removes it, after a
+     * call in progress has returned.
+     */
+    typedef std::function<void(const DsoFrame &frame)> frame_tap;
+    void set_frame_tap(const frame_tap &tap);
+
+    static const char *error_string(error_state state);
+
     run_mode get_run_mode() const;
     void set_run_mode(run_mode mode);
     int get_repeat_intvl() const;
     void set_repeat_intvl(int interval);
     bool isRepeating() const;
 	//boost::shared_ptr<DsoSnapshot> get_snapshot();
+
+    /**
+     * Hotplug handling. The hotplug thread sleeps in libusb until a
+     * DreamSourceLab device arrives or leaves. A detach stops the capture,
+     * a re-attach restores the configuration the capture last ran with
+     * and resumes it, the first frame after it is flagged discontinuous.
+     */
     void start_hotplug_proc();
     void stop_hotplug_proc();
     void register_hotplug_callback();
     void deregister_hotplug_callback();
     // thread for hotplug
     void hotplug_proc();
+    bool is_device_lost() const;
+
+    /**
+     * Capture watchdog. When no packet arrived for a few frame periods
+     * (and the hardware progress did not move) it restarts the capture
+     * with a new sampling thread, if that does not help it restarts the
+     * session, then re-opens the device. Each step is counted. A capture
+     * armed and waiting for its trigger is not stalled until it waited the
+     * armed limit, 0 for WatchdogArmedTimeouts stall timeouts, those
+     * waits are counted too. The re-opens back off exponentially and stop
+     * after WatchdogMaxReopens in a row, until packets arrive again.
+     */
+    void start_watchdog();
+    void stop_watchdog();
+    void set_watchdog_enabled(bool enable);
+    bool get_watchdog_enabled() const;
+    uint64_t get_watchdog_capture_restarts() const;
+    uint64_t get_watchdog_session_restarts() const;
+    uint64_t get_watchdog_reopens() const;
+    void set_watchdog_armed_limit(int64_t ms);
+    int64_t get_watchdog_armed_limit() const;
+    uint64_t get_watchdog_armed_timeouts() const;
+    uint64_t get_detach_count() const;
+    uint64_t get_attach_count() const;
     static int hotplug_callback(struct libusb_context *ctx, struct libusb_device *dev,
                                 libusb_hotplug_event event, void *user_data);
 private:
 	void set_capture_state(capture_state state);
 
+    void device_detach();
+    void device_attach();
+    void drop_device();
+    void restore_config();
+
+    void watchdog_proc();
+    void watchdog_check();
+    int64_t stall_timeout_ms() const;
+
 private:
     void sample_thread_proc(boost::shared_ptr<DevInst> dev_inst);
+    bool apply_sched(pthread_t thread, std::string &error);
+    bool try_sched(std::string &error);
 
 	void data_feed_in(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet);
 	static void data_feed_in_proc(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet, void *cb_data);
-	void feed_in_dso(const sr_datafeed_dso &dso);
+	void feed_in_dso(const sr_datafeed_dso &dso, int64_t timestamp_ns);
+
+    void apply_config(const config_change &change);
+    void apply_pending_config();
 
 private:
 	DeviceManager &_device_manager;
-    BlockingQueue<sr_datafeed_dso> &_dso_queue;
+    BlockingQueue<DsoFrame> &_dso_queue;
 	/**
 	 * The device instance that will be used in the next capture session.
 	 */
@@ -167,18 +290,93 @@ private:
     bool _instant;
     uint64_t _cur_samplerate;
     uint64_t _cur_samplelimits;
+    uint64_t _cur_vdiv;
+    unsigned int _dso_ch_num;
+
+    FramePool _frame_pool;
+
+    boost::mutex _tap_mutex;
+    frame_tap _frame_tap;
+    std::atomic<bool> _has_tap;
+    std::atomic<uint64_t> _dropped_frames;
+    std::atomic<uint64_t> _overflows;
+    std::atomic<uint64_t> _packet_errors;
+    uint64_t _frame_seq;
+    uint64_t _sample_pos;
+    bool _discontinuity;
+
+    boost::mutex _config_mutex;
+    std::vector<config_change> _pending_config;
+    std::atomic<bool> _config_pending;
+    bool _reconfigured;
+    // queue_config() calls so far, and the last one applied
+    uint64_t _config_gen;
+    std::atomic<uint64_t> _applied_config_gen;
 
     int _group_cnt;
 
 	std::unique_ptr<boost::thread> _sampling_thread;
 
+    boost::mutex _sched_mutex;
+    int _sched_policy;
+    int _sched_priority;
+    std::vector<int> _sched_cpus;
+    static std::atomic<bool> _memory_locked;
+
+    static const int HotplugWaitMs = 250;
+    // a DSCope re-enumerates once its firmware is loaded
+    static const int HotplugSettleMs = 200;
+
 	libusb_hotplug_callback_handle _hotplug_handle;
+    bool _hotplug_registered;
     std::unique_ptr<boost::thread> _hotplug;
-    bool _hot_attach;
-    bool _hot_detach;
+    std::atomic<bool> _hotplug_stop;
+    std::atomic<bool> _hot_attach;
+    std::atomic<bool> _hot_detach;
+    std::atomic<int64_t> _hot_event_ms;
+
+    // serializes starting and stopping the capture and swapping the device
+    // with the hotplug and watchdog threads, taken before _config_mutex
+    mutable boost::recursive_mutex _control_mutex;
+    std::string _driver_name;
+    std::atomic<bool> _device_lost;
+    std::atomic<uint64_t> _detach_count;
+    std::atomic<uint64_t> _attach_count;
+    bool _resume_on_attach;
+    bool _resume_instant;
+
+    static const int WatchdogPollMs = 100;
+    static const int WatchdogMinStallMs = 1000;
+    static const int WatchdogPeriods = 4;
+    static const int WatchdogMaxReopens = 5;
+    static const int WatchdogMaxBackoffMs = 60000;
+    static const int WatchdogArmedTimeouts = 10;
+
+    std::unique_ptr<boost::thread> _watchdog;
+    boost::mutex _watchdog_mutex;
+    boost::condition_variable _watchdog_cond;
+    bool _watchdog_stop;
+    std::atomic<bool> _watchdog_enabled;
+    int _watchdog_level;
+    int _watchdog_progress;
+    int _watchdog_reopen_streak;
+    int64_t _watchdog_backoff_ms;
+    std::atomic<int64_t> _watchdog_armed_ms;
+    // since when the capture made no progress, for the armed limit
+    std::atomic<int64_t> _watchdog_wait_ms;
+    std::atomic<int64_t> _watchdog_armed_limit_ms;
+    std::atomic<int64_t> _last_packet_ms;
+    std::atomic<uint64_t> _watchdog_capture_restarts;
+    std::atomic<uint64_t> _watchdog_session_restarts;
+    std::atomic<uint64_t> _watchdog_reopens;
+    std::atomic<uint64_t> _watchdog_armed_timeouts;
+
+    // what was applied to the device, replayed after a re-attach
+    std::map<std::pair<int, int>, uint64_t> _applied_config;
+    std::vector<std::pair<int, bool> > _ch_enabled;
 
     int    _noData_cnt;
-    bool _data_lock;
+    std::atomic<bool> _data_lock;
     bool _data_updated;
 
     uint64_t _trigger_pos;
@@ -28,6 +28,9 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+#include <boost/foreach.hpp>
 
 using namespace boost;
 
@@ -43,32 +46,252 @@ Snapshot::Snapshot(int unit_size, uint64_t total_sample_count, unsigned int chan
     _ring_sample_count(0),
     _unit_size(unit_size),
     _memory_failed(false),
-    _last_ended(true)
+    _last_ended(true),
+    _alloc_policy(AutoAlloc),
+    _front(0),
+    _readers(0),
+    _write_gen(0),
+    _pub_seq(0),
+    _pub_data(NULL),
+    _pub_count(0),
+    _pub_gen(0),
+    _pub_safe(0)
 {
     assert(_unit_size > 0);
+    memset(_storage, 0, sizeof(_storage));
 }
 
 Snapshot::~Snapshot()
 {
     free_data();
+    assert(_readers.load() == 0);
+    BOOST_FOREACH(storage &s, _retired)
+        release_storage(s);
+}
+
+Snapshot::read_guard::read_guard(const Snapshot &snapshot) :
+    _snapshot(snapshot)
+{
+    _snapshot._readers.fetch_add(1, std::memory_order_relaxed);
+    // pairs with the fence in reclaim_retired(): either the writer sees
+    // this reader, or this reader sees what was published before the
+    // storage was retired
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+Snapshot::read_guard::~read_guard()
+{
+    _snapshot._readers.fetch_sub(1, std::memory_order_release);
 }
 
 void Snapshot::free_data()
 {
-    if (_data) {
-        free(_data);
+    if (_storage[0].data || _storage[1].data) {
+        // nothing published may point at the released buffers
+        begin_write();
+        store_published(NULL, 0, _write_gen.load(std::memory_order_relaxed));
+        retire_storage(_storage[0]);
+        retire_storage(_storage[1]);
+        reclaim_retired();
         _data = NULL;
+        _front = 0;
         _capacity = 0;
         _sample_count = 0;
     }
     _ch_index.clear();
 }
 
+void Snapshot::release_storage(storage &s)
+{
+    if (s.mapped)
+        munmap(s.data, s.size);
+    else
+        free(s.data);
+    s.data = NULL;
+    s.size = 0;
+    s.mapped = false;
+}
+
+void Snapshot::retire_storage(storage &s)
+{
+    if (s.data)
+        _retired.push_back(s);
+    s.data = NULL;
+    s.size = 0;
+    s.mapped = false;
+}
+
+// called by the writer after it published a frame that no longer points
+// at the retired storage
+void Snapshot::reclaim_retired()
+{
+    if (_retired.empty())
+        return;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_readers.load(std::memory_order_acquire) != 0)
+        return;
+    BOOST_FOREACH(storage &s, _retired)
+        release_storage(s);
+    _retired.clear();
+}
+
+bool Snapshot::reserve_data(uint64_t size)
+{
+    if (size > _storage[0].size || size > _storage[1].size) {
+        // the published frame may go away with the old buffers
+        begin_write();
+        store_published(NULL, 0, _write_gen.load(std::memory_order_relaxed));
+    }
+
+    const bool ok = reserve_storage(_storage[0], size) &&
+                    reserve_storage(_storage[1], size);
+    reclaim_retired();
+    _data = _storage[_front].data;
+    return ok;
+}
+
+bool Snapshot::reserve_storage(storage &s, uint64_t size)
+{
+    if (s.data && size <= s.size)
+        return true;
+
+    if (s.data)
+        retire_storage(s);
+
+    if (_alloc_policy == HugePageAlloc ||
+        (_alloc_policy == AutoAlloc && size >= HugePageSize)) {
+        const uint64_t map_size = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+        void *data = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (data == MAP_FAILED) {
+            // no reserved huge pages, try transparent huge pages
+            data = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, map_size, MADV_HUGEPAGE);
+                memset(data, 0, map_size);
+            }
+        }
+        if (data != MAP_FAILED) {
+            s.data = data;
+            s.size = map_size;
+            s.mapped = true;
+            return true;
+        }
+    }
+
+    const uint64_t alloc_size = (size + DataAlignment - 1) / DataAlignment * DataAlignment;
+    if (posix_memalign(&s.data, DataAlignment, alloc_size) != 0) {
+        s.data = NULL;
+        return false;
+    }
+    s.size = alloc_size;
+    s.mapped = false;
+    return true;
+}
+
+void *Snapshot::back_data() const
+{
+    return _storage[_front ^ 1].data;
+}
+
+void Snapshot::begin_write()
+{
+    // readers that held the dropped storage may be gone by now
+    reclaim_retired();
+    _write_gen.store(_write_gen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    // the new generation is visible before any sample written after it
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+uint64_t Snapshot::write_generation() const
+{
+    return _write_gen.load(std::memory_order_relaxed);
+}
+
+void Snapshot::publish(uint64_t sample_count, bool swap)
+{
+    if (swap) {
+        _front ^= 1;
+        _data = _storage[_front].data;
+    }
+    _sample_count.store(sample_count, std::memory_order_release);
+
+    // a swapped frame is only overwritten two generations later, when the
+    // writer is back on this buffer; a ring write reuses it right away
+    const uint64_t gen = _write_gen.load(std::memory_order_relaxed);
+    store_published(_data, sample_count, swap ? gen + 1 : gen);
+}
+
+void Snapshot::store_published(const void *data, uint64_t sample_count,
+                               uint64_t last_safe_write)
+{
+    const uint64_t seq = _pub_seq.load(std::memory_order_relaxed);
+    _pub_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _pub_data.store(data, std::memory_order_relaxed);
+    _pub_count.store(sample_count, std::memory_order_relaxed);
+    _pub_gen.store(_write_gen.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    _pub_safe.store(last_safe_write, std::memory_order_relaxed);
+    _pub_seq.store(seq + 2, std::memory_order_release);
+}
+
+Snapshot::frame_ref Snapshot::acquire_frame() const
+{
+    assert(_readers.load(std::memory_order_relaxed) > 0);
+    frame_ref ref;
+    uint64_t seq0, seq1;
+    do {
+        seq0 = _pub_seq.load(std::memory_order_acquire);
+        ref.data = _pub_data.load(std::memory_order_relaxed);
+        ref.sample_count = _pub_count.load(std::memory_order_relaxed);
+        ref.generation = _pub_gen.load(std::memory_order_relaxed);
+        ref.last_safe_write = _pub_safe.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq1 = _pub_seq.load(std::memory_order_relaxed);
+    } while ((seq0 & 1) || seq0 != seq1);
+    return ref;
+}
+
+bool Snapshot::frame_valid(const frame_ref &ref) const
+{
+    // order the sample reads before the generation check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return ref.data != NULL &&
+           _write_gen.load(std::memory_order_relaxed) <= ref.last_safe_write;
+}
+
+uint64_t Snapshot::get_generation() const
+{
+    return _pub_gen.load(std::memory_order_acquire);
+}
+
+Snapshot::alloc_policy Snapshot::get_alloc_policy() const
+{
+    return _alloc_policy;
+}
+
+void Snapshot::set_alloc_policy(alloc_policy policy)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
+    if (policy == _alloc_policy)
+        return;
+    _alloc_policy = policy;
+    // the next payload allocates with the new policy
+    free_data();
+}
+
 bool Snapshot::memory_failed() const
 {
     return _memory_failed;
 }
 
+bool Snapshot::memory_mapped() const
+{
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
+    return _storage[_front].mapped;
+}
+
 bool Snapshot::empty() const
 {
     if (get_sample_count() == 0)
@@ -89,8 +312,7 @@ void Snapshot::set_last_ended(bool ended)
 
 uint64_t Snapshot::get_sample_count() const
 {
-    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
-    return _sample_count;
+    return _sample_count.load(std::memory_order_acquire);
 }
 
 const void* Snapshot::get_data() const
@@ -23,6 +23,8 @@
 #ifndef DSVIEW_PV_DATA_SNAPSHOT_H
 #define DSVIEW_PV_DATA_SNAPSHOT_H
 
+#include <atomic>
+#include <vector>
 #include <boost/thread.hpp>
 
 //namespace pv {
@@ -30,6 +32,57 @@
 
 class Snapshot
 {
+public:
+    /**
+     * How the sample storage is allocated.
+     * HugePageAlloc maps 2 MiB huge pages with MAP_POPULATE, falls back to
+     * transparent huge pages and then to AlignedAlloc. AutoAlloc (the
+     * default) maps buffers of at least HugePageSize and aligns smaller
+     * ones, which would waste most of a huge page.
+     */
+    enum alloc_policy {
+        AlignedAlloc,
+        HugePageAlloc,
+        AutoAlloc
+    };
+
+    static const uint64_t DataAlignment = 64;
+    static const uint64_t HugePageSize = 2 * 1024 * 1024;
+
+    /**
+     * A published frame, taken without the writer's lock.
+     * The samples behind data are not written again before the writer
+     * starts generation last_safe_write + 1. Read them, then check
+     * frame_valid() and take the frame again if it failed. Frames are
+     * only taken and read under a read_guard.
+     */
+    struct frame_ref {
+        const void *data;
+        uint64_t sample_count;
+        uint64_t generation;
+        uint64_t last_safe_write;
+    };
+
+    /**
+     * Held while frames are taken and read. Storage the writer drops
+     * meanwhile (free, resize, policy change) is retired and released only
+     * when no reader holds a guard, so a frame never points at freed or
+     * unmapped memory. A reader may still see overwritten samples, which
+     * frame_valid() reports.
+     */
+    class read_guard
+    {
+    public:
+        explicit read_guard(const Snapshot &snapshot);
+        ~read_guard();
+
+    private:
+        read_guard(const read_guard &);
+        read_guard &operator=(const read_guard &);
+
+        const Snapshot &_snapshot;
+    };
+
 public:
     Snapshot(int unit_size, uint64_t total_sample_count, unsigned int channel_num);
 
@@ -45,6 +98,9 @@ public:
     int unit_size() const;
 
     bool memory_failed() const;
+
+    // the samples are in mapped (huge page) storage
+    bool memory_mapped() const;
     bool empty() const;
 
     bool last_ended() const;
@@ -54,9 +110,49 @@ public:
 
     virtual void capture_ended();
 
+    alloc_policy get_alloc_policy() const;
+    void set_alloc_policy(alloc_policy policy);
+
+    frame_ref acquire_frame() const;
+    bool frame_valid(const frame_ref &ref) const;
+    uint64_t get_generation() const;
+
 protected:
     virtual void free_data();
 
+    /**
+     * Make _data and the back buffer hold at least size bytes each.
+     * The buffers are re-used when they are large enough already, they
+     * only grow up to the high-water mark.
+     */
+    bool reserve_data(uint64_t size);
+
+    /**
+     * Writer side of the frame publication, called with _mutex held.
+     * begin_write() goes before any sample is written, publish() after.
+     * A whole frame is written to back_data() and published with
+     * swap set, readers keep the previous frame meanwhile. Ring (instant)
+     * writes go to _data in place and publish without swap.
+     */
+    void *back_data() const;
+    void begin_write();
+    uint64_t write_generation() const;
+    void publish(uint64_t sample_count, bool swap);
+
+private:
+    struct storage {
+        void *data;
+        uint64_t size;
+        bool mapped;
+    };
+
+    bool reserve_storage(storage &s, uint64_t size);
+    void release_storage(storage &s);
+    void retire_storage(storage &s);
+    void reclaim_retired();
+    void store_published(const void *data, uint64_t sample_count,
+                         uint64_t last_safe_write);
+
 protected:
     mutable boost::recursive_mutex _mutex;
 
@@ -66,12 +162,31 @@ protected:
 
     uint64_t _capacity;
     unsigned int _channel_num;
-	uint64_t _sample_count;
+    std::atomic<uint64_t> _sample_count;
     uint64_t _total_sample_count;
-    uint64_t _ring_sample_count;
+    std::atomic<uint64_t> _ring_sample_count;
 	int _unit_size;
     bool _memory_failed;
     bool _last_ended;
+
+private:
+    alloc_policy _alloc_policy;
+    storage _storage[2];
+    int _front;
+
+    // dropped storage a reader may still hold, and the readers holding a guard
+    std::vector<storage> _retired;
+    mutable std::atomic<unsigned int> _readers;
+
+    // generation being written, readers validate against it
+    std::atomic<uint64_t> _write_gen;
+
+    // seqlock around the published frame
+    std::atomic<uint64_t> _pub_seq;
+    std::atomic<const void*> _pub_data;
+    std::atomic<uint64_t> _pub_count;
+    std::atomic<uint64_t> _pub_gen;
+    std::atomic<uint64_t> _pub_safe;
 };
 
 //} // namespace data
@@ -0,0 +1,309 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "spectrum.h"
+
+const float Spectrum::FloorDb = -200.0f;
+
+Spectrum::Spectrum() :
+        _mode(Latest),
+        _window(Hann),
+        _count(DefaultCount),
+        _bins(DefaultBins),
+        _frames(0),
+        _vdiv(0),
+        _n(0),
+        _win_sum(0)
+{
+}
+
+Spectrum::mode Spectrum::get_mode() const
+{
+    return _mode;
+}
+
+void Spectrum::set_mode(mode m)
+{
+    _mode = m;
+    reset();
+}
+
+Spectrum::window Spectrum::get_window() const
+{
+    return _window;
+}
+
+void Spectrum::set_window(window w)
+{
+    _window = w;
+    if (_n > 0)
+        make_window();
+    reset();
+}
+
+unsigned int Spectrum::get_count() const
+{
+    return _count;
+}
+
+void Spectrum::set_count(unsigned int count)
+{
+    assert(count > 0 && count <= MaxCount);
+    _count = count;
+    reset();
+}
+
+unsigned int Spectrum::get_bins() const
+{
+    return _bins;
+}
+
+void Spectrum::set_bins(unsigned int bins)
+{
+    assert(bins > 0 && bins <= MaxBins);
+    _bins = bins;
+}
+
+void Spectrum::reset()
+{
+    _frames = 0;
+}
+
+unsigned int Spectrum::frames() const
+{
+    return _frames;
+}
+
+size_t Spectrum::size() const
+{
+    return _n;
+}
+
+size_t Spectrum::bins() const
+{
+    return std::min<size_t>(_bins, _n / 2);
+}
+
+bool Spectrum::add(const uint8_t *data, size_t len, uint64_t vdiv)
+{
+    if (len < MinSize || vdiv == 0)
+        return false;
+    size_t n = MinSize;
+    while (n * 2 <= std::min(len, (size_t)MaxSize))
+        n *= 2;
+    if (n != _n) {
+        plan(n);
+        reset();
+    }
+    if (vdiv != _vdiv) {
+        _vdiv = vdiv;
+        reset();
+    }
+
+    load(data);
+    transform();
+    accumulate();
+    return true;
+}
+
+// The complex transform is decimated in frequency, it reads its input in
+// order and leaves the output in bit reversed order, the split reads it
+// through _rev.
+void Spectrum::plan(size_t n)
+{
+    const size_t m = n / 2;
+    unsigned int bits = 0;
+    while ((size_t(1) << bits) < m)
+        bits++;
+    _rev.resize(m);
+    for (size_t i = 0; i < m; i++) {
+        uint32_t r = 0;
+        for (unsigned int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        _rev[i] = r;
+    }
+
+    // exp(-i pi j / h) for the stage of half h
+    _tw_re.resize(m);
+    _tw_im.resize(m);
+    for (size_t h = 1; h < m; h <<= 1) {
+        for (size_t j = 0; j < h; j++) {
+            const double a = -M_PI * j / h;
+            _tw_re[h - 1 + j] = (float)cos(a);
+            _tw_im[h - 1 + j] = (float)sin(a);
+        }
+    }
+
+    // exp(-2 i pi k / n) for the split
+    _split_re.resize(m);
+    _split_im.resize(m);
+    for (size_t k = 0; k < m; k++) {
+        const double a = -2.0 * M_PI * k / n;
+        _split_re[k] = (float)cos(a);
+        _split_im[k] = (float)sin(a);
+    }
+
+    _re.resize(m);
+    _im.resize(m);
+    _power.assign(m, 0.0f);
+    _n = n;
+    make_window();
+}
+
+void Spectrum::make_window()
+{
+    const size_t m = _n / 2;
+    _win_even.resize(m);
+    _win_odd.resize(m);
+    _win_sum = 0;
+    for (size_t i = 0; i < _n; i++) {
+        const double x = 2.0 * M_PI * i / _n;
+        double w;
+        switch (_window) {
+        case Hann:
+            w = 0.5 - 0.5 * cos(x);
+            break;
+        case Hamming:
+            w = 0.54 - 0.46 * cos(x);
+            break;
+        case BlackmanHarris:
+            w = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+            break;
+        case FlatTop:
+            w = 0.21557895 - 0.41663158 * cos(x) + 0.277263158 * cos(2 * x)
+                - 0.083578947 * cos(3 * x) + 0.006947368 * cos(4 * x);
+            break;
+        default:
+            w = 1.0;
+            break;
+        }
+        if (i & 1)
+            _win_odd[i / 2] = (float)w;
+        else
+            _win_even[i / 2] = (float)w;
+        _win_sum += w;
+    }
+}
+
+// the even samples are the real parts, the odd samples the imaginary
+// parts, as levels about mid scale times the window
+void Spectrum::load(const uint8_t *data)
+{
+    const size_t m = _n / 2;
+    const float *we = _win_even.data();
+    const float *wo = _win_odd.data();
+    float *re = _re.data();
+    float *im = _im.data();
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_set1_epi16(0xff);
+    const __m128 mid = _mm_set1_ps(127.5f);
+    auto store = [&](size_t j, __m128i v16, float *dst, const float *w) {
+        const __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v16, zero));
+        const __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v16, zero));
+        _mm_storeu_ps(dst + j, _mm_mul_ps(_mm_sub_ps(mid, lo), _mm_loadu_ps(w + j)));
+        _mm_storeu_ps(dst + j + 4, _mm_mul_ps(_mm_sub_ps(mid, hi), _mm_loadu_ps(w + j + 4)));
+    };
+    for (; i + 8 <= m; i += 8) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        store(i, _mm_and_si128(x, low), re, we);
+        store(i, _mm_srli_epi16(x, 8), im, wo);
+    }
+#endif
+    for (; i < m; i++) {
+        re[i] = (127.5f - data[2 * i]) * we[i];
+        im[i] = (127.5f - data[2 * i + 1]) * wo[i];
+    }
+}
+
+void Spectrum::transform()
+{
+    const size_t m = _n / 2;
+    float *re = _re.data();
+    float *im = _im.data();
+    for (size_t h = m / 2; h > 0; h >>= 1) {
+        const float *wr = _tw_re.data() + h - 1;
+        const float *wi = _tw_im.data() + h - 1;
+        for (size_t s = 0; s < m; s += 2 * h) {
+            float *ar = re + s, *ai = im + s;
+            float *br = ar + h, *bi = ai + h;
+            size_t j = 0;
+#if defined(__SSE2__)
+            for (; j + 4 <= h; j += 4) {
+                const __m128 ur = _mm_loadu_ps(ar + j), ui = _mm_loadu_ps(ai + j);
+                const __m128 vr = _mm_loadu_ps(br + j), vi = _mm_loadu_ps(bi + j);
+                const __m128 tr = _mm_loadu_ps(wr + j), ti = _mm_loadu_ps(wi + j);
+                const __m128 dr = _mm_sub_ps(ur, vr), di = _mm_sub_ps(ui, vi);
+                _mm_storeu_ps(ar + j, _mm_add_ps(ur, vr));
+                _mm_storeu_ps(ai + j, _mm_add_ps(ui, vi));
+                _mm_storeu_ps(br + j, _mm_sub_ps(_mm_mul_ps(dr, tr), _mm_mul_ps(di, ti)));
+                _mm_storeu_ps(bi + j, _mm_add_ps(_mm_mul_ps(dr, ti), _mm_mul_ps(di, tr)));
+            }
+#endif
+            for (; j < h; j++) {
+                const float dr = ar[j] - br[j], di = ai[j] - bi[j];
+                ar[j] += br[j];
+                ai[j] += bi[j];
+                br[j] = dr * wr[j] - di * wi[j];
+                bi[j] = dr * wi[j] + di * wr[j];
+            }
+        }
+    }
+}
+
+// X[k] = (Z[k] + Z*[m - k]) / 2 - i exp(-2 i pi k / n) (Z[k] - Z*[m - k]) / 2
+void Spectrum::accumulate()
+{
+    const size_t m = _n / 2;
+    const float *re = _re.data();
+    const float *im = _im.data();
+    const uint32_t *rev = _rev.data();
+    float *power = _power.data();
+    const bool max_hold = _mode == MaxHold && _frames > 0;
+    const unsigned int weight = _mode == Average ? std::min(_frames + 1, _count) : 1;
+    const float alpha = 1.0f / weight;
+    for (size_t k = 0; k < m; k++) {
+        const size_t p = rev[k];
+        const size_t q = rev[(m - k) & (m - 1)];
+        const float er = 0.5f * (re[p] + re[q]);
+        const float ei = 0.5f * (im[p] - im[q]);
+        const float orr = 0.5f * (im[p] + im[q]);
+        const float oi = -0.5f * (re[p] - re[q]);
+        const float xr = er + _split_re[k] * orr - _split_im[k] * oi;
+        const float xi = ei + _split_re[k] * oi + _split_im[k] * orr;
+        const float pw = xr * xr + xi * xi;
+        if (max_hold)
+            power[k] = std::max(power[k], pw);
+        else
+            power[k] += alpha * (pw - power[k]);
+    }
+    _frames++;
+}
+
+// a sine of peak amplitude a shows as a * win_sum / 2 in its bin, the
+// DC bin as the mean times win_sum
+void Spectrum::to_db(float *dst) const
+{
+    const size_t m = _n / 2;
+    const size_t out = bins();
+    const double mv = 2.0 / _win_sum * _vdiv / 25.6;
+    const double norm = mv * mv * 1e-6;
+    for (size_t b = 0; b < out; b++) {
+        const size_t first = b * m / out;
+        const size_t last = std::max(first + 1, (b + 1) * m / out);
+        float peak = 0.0f;
+        for (size_t k = first; k < last; k++)
+            peak = std::max(peak, k == 0 ? 0.25f * _power[0] : _power[k]);
+        const double p = peak * norm;
+        dst[b] = p > 0 ? std::max(FloorDb, (float)(10.0 * log10(p))) : FloorDb;
+    }
+}
@@ -0,0 +1,119 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _SPECTRUM_H_
+#define _SPECTRUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Power spectrum of raw frames, averaged or max held over the frames.
+ *
+ * A frame of len samples is transformed with the largest power of two
+ * n <= len, the samples after n are not used. The plan of an n point real
+ * transform (twiddles, bit reversal and the window) is kept until the
+ * frame size changes. The raw bytes are windowed while they are loaded as
+ * the even and odd halves of an n / 2 point complex transform, which is
+ * split into the n / 2 bins of the real spectrum, the Nyquist bin is not
+ * kept.
+ *
+ * Average mode keeps the mean power of all frames until count were added,
+ * then an exponential average that weighs each new frame by 1 / count,
+ * so older frames fade out rather than drop out. Max hold keeps the
+ * largest power per bin since the reset. The bins are decimated to at
+ * most bins output bins, each the largest of its group, in dBV of a
+ * sine's peak amplitude.
+ */
+class Spectrum
+{
+public:
+    enum mode {
+        Latest,
+        Average,
+        MaxHold
+    };
+
+    enum window {
+        Rectangular,
+        Hann,
+        Hamming,
+        BlackmanHarris,
+        FlatTop
+    };
+
+    static const size_t MinSize = 16;
+    static const size_t MaxSize = 1 << 20;
+    static const unsigned int DefaultBins = 1024;
+    static const unsigned int MaxBins = 65536;
+    static const unsigned int DefaultCount = 8;
+    static const unsigned int MaxCount = 65536;
+
+    // the output of an empty bin
+    static const float FloorDb;
+
+public:
+    Spectrum();
+
+    mode get_mode() const;
+    void set_mode(mode m);
+
+    window get_window() const;
+    void set_window(window w);
+
+    unsigned int get_count() const;
+    void set_count(unsigned int count);
+
+    unsigned int get_bins() const;
+    void set_bins(unsigned int bins);
+
+    // the next frame starts the spectrum over
+    void reset();
+
+    /**
+     * Add the spectrum of len raw samples captured with vdiv.
+     * @return false when the frame is shorter than MinSize
+     */
+    bool add(const uint8_t *data, size_t len, uint64_t vdiv);
+
+    // frames in the spectrum since the reset
+    unsigned int frames() const;
+
+    // the transform size, 0 before the first frame
+    size_t size() const;
+
+    // the output bins, bin b covers b to b + 1 times samplerate / 2 / bins
+    size_t bins() const;
+
+    // write bins() decimated bins in dBV
+    void to_db(float *dst) const;
+
+private:
+    void plan(size_t n);
+    void make_window();
+    void load(const uint8_t *data);
+    void transform();
+    void accumulate();
+
+private:
+    mode _mode;
+    window _window;
+    unsigned int _count;
+    unsigned int _bins;
+    unsigned int _frames;
+    uint64_t _vdiv;
+
+    // the plan of an n point real transform, m = n / 2 complex points
+    size_t _n;
+    std::vector<uint32_t> _rev;
+    std::vector<float> _tw_re, _tw_im;      // per stage of half h at h - 1
+    std::vector<float> _split_re, _split_im;
+    std::vector<float> _win_even, _win_odd;
+    double _win_sum;
+
+    std::vector<float> _re, _im;
+    std::vector<float> _power;
+};
+
+#endif  // _SPECTRUM_H_
@@ -0,0 +1,160 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <json.hpp>
+
+#include "tracer.h"
+
+using json = nlohmann::json;
+
+namespace Tracer {
+
+std::atomic<bool> _enabled(false);
+
+namespace {
+
+struct event {
+    const char *name;
+    int64_t ts_ns;
+    uint32_t tid;
+    char phase;
+};
+
+// written by its thread only, released for re-use when the thread exits
+struct ring {
+    std::vector<event> events;
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> start;    // events before it were cleared
+    std::atomic<bool> in_use;
+    uint32_t tid;
+
+    ring() : events(RingEvents), head(0), start(0), in_use(true), tid(0) {}
+};
+
+std::mutex _rings_mutex;
+std::vector<std::unique_ptr<ring> > _rings;
+
+struct thread_ring {
+    ring *r;
+
+    thread_ring() : r(NULL) {}
+    ~thread_ring()
+    {
+        if (r)
+            r->in_use.store(false, std::memory_order_release);
+    }
+};
+
+thread_local thread_ring _thread_ring;
+
+ring *get_ring()
+{
+    if (_thread_ring.r)
+        return _thread_ring.r;
+
+    // the sampling thread is re-created per capture, re-use its ring
+    std::lock_guard<std::mutex> lock(_rings_mutex);
+    ring *r = NULL;
+    for (auto &candidate : _rings) {
+        bool free = false;
+        if (candidate->in_use.compare_exchange_strong(free, true)) {
+            r = candidate.get();
+            break;
+        }
+    }
+    if (!r) {
+        _rings.emplace_back(new ring());
+        r = _rings.back().get();
+    }
+    r->tid = (uint32_t)syscall(SYS_gettid);
+    _thread_ring.r = r;
+    return r;
+}
+
+int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record(const char *name, char phase)
+{
+    ring *r = get_ring();
+    const uint64_t head = r->head.load(std::memory_order_relaxed);
+    event &e = r->events[head % RingEvents];
+    e.name = name;
+    e.ts_ns = now_ns();
+    e.tid = r->tid;
+    e.phase = phase;
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+}
+
+void enable(bool on)
+{
+    _enabled.store(on, std::memory_order_relaxed);
+}
+
+void begin(const char *name)
+{
+    record(name, 'B');
+}
+
+void end(const char *name)
+{
+    record(name, 'E');
+}
+
+std::string dump()
+{
+    const int pid = getpid();
+    json trace_events = json::array();
+
+    std::lock_guard<std::mutex> lock(_rings_mutex);
+    std::vector<event> events;
+    for (auto &r : _rings) {
+        const uint64_t head = r->head.load(std::memory_order_acquire);
+        const uint64_t first = std::max(head > RingEvents ? head - RingEvents : 0,
+                                        r->start.load(std::memory_order_relaxed));
+        events.assign(RingEvents, event());
+        for (uint64_t i = first; i < head; i++)
+            events[i % RingEvents] = r->events[i % RingEvents];
+
+        // drop what the thread overwrote while it was copied
+        const uint64_t after = r->head.load(std::memory_order_acquire);
+        const uint64_t valid = after > RingEvents ? after - RingEvents : 0;
+        for (uint64_t i = std::max(first, valid); i < head; i++) {
+            const event &e = events[i % RingEvents];
+            json j;
+            j["name"] = e.name;
+            j["ph"] = std::string(1, e.phase);
+            j["ts"] = e.ts_ns / 1e3;
+            j["pid"] = pid;
+            j["tid"] = e.tid;
+            trace_events.push_back(j);
+        }
+    }
+
+    json trace;
+    trace["traceEvents"] = trace_events;
+    trace["displayTimeUnit"] = "ns";
+    return trace.dump();
+}
+
+void clear()
+{
+    std::lock_guard<std::mutex> lock(_rings_mutex);
+    for (auto &r : _rings)
+        r->start.store(r->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+}
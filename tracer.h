@@ -0,0 +1,61 @@
+// Copyright (c) 2017 Manfeel
+// manfeel@foxmail.com
+
+#ifndef _TRACER_H_
+#define _TRACER_H_
+
+#include <atomic>
+#include <string>
+
+/**
+ * Begin/end event recorder for the capture pipeline.
+ *
+ * Every thread records into its own ring of RingEvents events, the oldest
+ * events are overwritten. While recording is off a TRACE_SCOPE costs one
+ * relaxed load. dump() renders the rings of all threads as Chrome Trace
+ * Event JSON, which chrome://tracing or Perfetto open directly.
+ */
+namespace Tracer {
+
+static const size_t RingEvents = 64 * 1024;
+
+extern std::atomic<bool> _enabled;
+
+inline bool enabled()
+{
+    return _enabled.load(std::memory_order_relaxed);
+}
+
+void enable(bool on);
+
+// name must stay valid until the trace is dumped, use literals
+void begin(const char *name);
+void end(const char *name);
+
+std::string dump();
+void clear();
+
+struct Scope {
+    explicit Scope(const char *name) :
+        _name(enabled() ? name : NULL)
+    {
+        if (_name)
+            begin(_name);
+    }
+
+    ~Scope()
+    {
+        if (_name)
+            end(_name);
+    }
+
+    const char *_name;
+};
+
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Tracer::Scope TRACE_CONCAT(_trace_scope_, __LINE__)(name)
+
+#endif  // _TRACER_H_